@@ -9,17 +9,50 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 INCLUDEPATH += .
 
-HEADERS += handcontrolthread.h \
+HEADERS += allocationcheck.h \
+           handclock.h \
+           handcontrolthread.h \
+           handrig.h \
+           handtrace.h \
+           motionsequence.h \
            motorspeeddlg.h \
-           motortest.h
-
-SOURCES += handcontrolthread.cpp \
+           motortest.h \
+           positioncalibration.h \
+           positionplot.h \
+           pwmoutput.h \
+           rigbench.h \
+           rigwindow.h \
+           samplehistory.h
+
+SOURCES += allocationcheck.cpp \
+           handclock.cpp \
+           handcontrolthread.cpp \
+           handrig.cpp \
+           handtrace.cpp \
            main.cpp \
+           motionsequence.cpp \
            motorspeeddlg.cpp \
-           motortest.cpp
+           motortest.cpp \
+           positioncalibration.cpp \
+           positionplot.cpp \
+           pwmoutput.cpp \
+           rigbench.cpp \
+           rigwindow.cpp \
+           samplehistory.cpp
 
 FORMS += motortest.ui
 
+# counts heap allocations in the control loop, see allocationcheck.h
+alloccheck {
+    DEFINES += ALLOC_CHECK
+}
+
+# "make check" builds the allocation check (tests/alloccheck) on the host and
+# runs it, failing if the control loop touches the heap
+check.commands = mkdir -p $$OUT_PWD/tests/alloccheck && cd $$OUT_PWD/tests/alloccheck && \
+    $$QMAKE_QMAKE $$PWD/tests/alloccheck/alloccheck.pro && $(MAKE) check
+QMAKE_EXTRA_TARGETS += check
+
 target.path = /usr/bin
 INSTALLS += target
 
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <stddef.h>
+
+#include "allocationcheck.h"
+
+#ifdef ALLOC_CHECK
+
+#include <pthread.h>
+
+// only the watched thread writes the count
+static pthread_t s_thread;
+static volatile bool s_watching = false;
+static volatile int s_count = 0;
+
+static inline void countAllocation()
+{
+	if (s_watching && pthread_equal(pthread_self(), s_thread))
+		s_count++;
+}
+
+// Qt containers and strings go to malloc directly rather than operator new,
+// so malloc itself is replaced (operator new ends up here as well)
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	countAllocation();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+	countAllocation();
+	return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	countAllocation();
+	return __libc_realloc(ptr, size);
+}
+
+}
+
+bool AllocationCheck::enabled()
+{
+	return true;
+}
+
+void AllocationCheck::watchCurrentThread()
+{
+	s_count = 0;
+	s_thread = pthread_self();
+	s_watching = true;
+}
+
+void AllocationCheck::stop()
+{
+	s_watching = false;
+}
+
+int AllocationCheck::count()
+{
+	return s_count;
+}
+
+#else
+
+bool AllocationCheck::enabled()
+{
+	return false;
+}
+
+void AllocationCheck::watchCurrentThread()
+{
+}
+
+void AllocationCheck::stop()
+{
+}
+
+int AllocationCheck::count()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef ALLOCATIONCHECK_H
+#define ALLOCATIONCHECK_H
+
+/// Counts heap allocations made by one thread, to check the control loop runs
+/// without touching the heap once it is going.
+///
+/// Counting needs a build with CONFIG+=alloccheck, which replaces malloc for
+/// the whole program (glibc only); in a normal build nothing is counted.
+/// The check is a replay of a recorded trace, which exits with an error if the
+/// control loop allocated after its warm-up. "make check" runs it on a trace
+/// kept with the test (tests/alloccheck), or by hand in an alloccheck build:
+///   MotorTest -replay <file>
+class AllocationCheck
+{
+public:
+	/// true in a CONFIG+=alloccheck build
+	static bool enabled();
+
+	/// starts counting allocations made by the calling thread
+	static void watchCurrentThread();
+
+	/// stops counting
+	static void stop();
+
+	/// allocations counted, read once stop() has been called
+	static int count();
+};
+
+#endif // ALLOCATIONCHECK_H
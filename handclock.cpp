@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <QThread>
+
+#include "handclock.h"
+
+/// QThread::msleep and usleep are protected in Qt4
+class SleepHelper : public QThread
+{
+public:
+	static void sleepMs(int iMs) { QThread::msleep(iMs); }
+	static void sleepUs(int iUs) { QThread::usleep(iUs); }
+};
+
+RealTimeClock::RealTimeClock()
+{
+	m_timer.start();
+}
+
+qint64 RealTimeClock::nowUs()
+{
+	return m_timer.nsecsElapsed() / 1000;
+}
+
+void RealTimeClock::sleepMs(int iMs)
+{
+	SleepHelper::sleepMs(iMs);
+}
+
+void RealTimeClock::sleepUs(int iUs)
+{
+	SleepHelper::sleepUs(iUs);
+}
+
+bool RealTimeClock::waitMs(QWaitCondition *iCondition, QMutex *iMutex, int iMs)
+{
+	return iCondition->wait(iMutex, iMs);
+}
+
+VirtualClock::VirtualClock()
+{
+	m_nowUs = 0;
+}
+
+qint64 VirtualClock::nowUs()
+{
+	return m_nowUs;
+}
+
+void VirtualClock::sleepMs(int iMs)
+{
+	m_nowUs += iMs * 1000LL;
+}
+
+void VirtualClock::sleepUs(int iUs)
+{
+	m_nowUs += iUs;
+}
+
+bool VirtualClock::waitMs(QWaitCondition *, QMutex *, int iMs)
+{
+	// nothing can arrive "during" a virtual wait, the caller sees any wakeup
+	// request on its next check
+	m_nowUs += iMs * 1000LL;
+
+	return false;
+}
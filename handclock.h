@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef HANDCLOCK_H
+#define HANDCLOCK_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+
+/// Time source for the control thread.
+/// Every sleep, timeout and timestamp in HandControlThread goes through one of
+/// these, so the control loop can be run against wall time or a virtual clock.
+class HandClock
+{
+public:
+	virtual ~HandClock() {}
+
+	/// monotonic time in usec
+	virtual qint64 nowUs() = 0;
+
+	/// blocks the calling (control) thread for iMs
+	virtual void sleepMs(int iMs) = 0;
+
+	/// as sleepMs, for the last part of a wait that is less than 1 msec
+	virtual void sleepUs(int iUs) = 0;
+
+	/// waits on iCondition for up to iMs, iMutex must be locked by the caller
+	/// returns false on timeout
+	virtual bool waitMs(QWaitCondition *iCondition, QMutex *iMutex, int iMs) = 0;
+};
+
+/// Wall clock time, the normal mode
+class RealTimeClock : public HandClock
+{
+public:
+	RealTimeClock();
+
+	qint64 nowUs();
+	void sleepMs(int iMs);
+	void sleepUs(int iUs);
+	bool waitMs(QWaitCondition *iCondition, QMutex *iMutex, int iMs);
+
+private:
+	QElapsedTimer m_timer;
+};
+
+/// Simulated time that advances instantly on every sleep or wait, so the
+/// control loop runs as fast as the CPU allows with the same tick sequence.
+/// Only the control thread may call it.
+class VirtualClock : public HandClock
+{
+public:
+	VirtualClock();
+
+	qint64 nowUs();
+	void sleepMs(int iMs);
+	void sleepUs(int iUs);
+	bool waitMs(QWaitCondition *iCondition, QMutex *iMutex, int iMs);
+
+private:
+	qint64 m_nowUs;
+};
+
+#endif // HANDCLOCK_H
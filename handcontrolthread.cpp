@@ -9,10 +9,21 @@
 
 #include <QEventLoop>
 #include "handcontrolthread.h"
+#include "samplehistory.h"
+#include "handclock.h"
+#include "handtrace.h"
+#include "positioncalibration.h"
+#include "motionsequence.h"
+#include "handrig.h"
+#include "allocationcheck.h"
+#include "pwmoutput.h"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
 
 #ifdef Q_WS_QWS
 #include <sys/ioctl.h>
-#include <unistd.h>
 #endif
 
 #include <fcntl.h>
@@ -40,6 +51,9 @@
 /// names of built-in PWM devices
 const char PWM_DEVICES[2][20] = {"/dev/pwm8", "/dev/pwm9"};
 
+/// PWM frequency for sysfs channels (Hz)
+const int DEFAULT_PWM_FREQUENCY_HZ = 5000;
+
 /// names of gpio
 const char GPIO_DEVICES[NUM_FINGERS][40] = {"/sys/class/gpio/gpio17/value",
                                 "/sys/class/gpio/gpio21/value",
@@ -51,6 +65,60 @@ const char ADC_FINGER_POS_DEVICE[] = "/sys/class/hwmon/hwmon0/device/in2_and_7_i
 /// name of the device for getting ADCIN3 from the SOM (battery level)
 const char ADC_BATTERY_DEVICE[] = "/sys/class/hwmon/hwmon0/device/in3_input";
 
+HandDevices::HandDevices()
+{
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        pwm[i] = PWM_DEVICES[i];
+        gpio[i] = GPIO_DEVICES[i];
+    }
+
+    pwmFrequencyHz = DEFAULT_PWM_FREQUENCY_HZ;
+
+    fingerPositionAdc = ADC_FINGER_POS_DEVICE;
+    batteryAdc = ADC_BATTERY_DEVICE;
+}
+
+/// period of the pwm state machine tick (msec), two per loop
+const int TICK_MS = 5;
+
+/// period of the housekeeping tick while idle (msec)
+const int IDLE_TICK_MS = 100;
+
+/// read the battery every this many idle ticks (around once/second)
+const int IDLE_BATTERY_TICKS = 10;
+
+/// default stall detection: less than 1 unit of movement over 10 position samples
+/// (around 300 msec) with the drive on
+const int DEFAULT_STALL_SAMPLES = 10;
+const int DEFAULT_STALL_MIN_PROGRESS = 1;
+
+/// calibration sweep: drive level, how far the raw sample has to move to count as
+/// progress, and how many samples without progress mean the end has been reached
+const qint16 CAL_DRIVE_LEVEL = 30;
+const int CAL_MIN_PROGRESS = 2;
+const int CAL_STALL_SAMPLES = 10;
+
+/// battery compensation: the filter takes 1/4 of each new sample (samples are
+/// around a second apart), and the PWM is never scaled below half
+const int BATT_FILTER_SHIFT = 2;
+const int BATT_UNITY_GAIN = 1000;
+const int BATT_MIN_GAIN = 500;
+
+/// highest PWM value
+const int PWM_MAX = 100;
+
+/// simulated battery, full and where its sag stops
+const quint16 SIM_BATTERY_FULL = 100;
+const quint16 SIM_BATTERY_EMPTY = 60;
+
+/// ticks the control loop runs before allocations are counted, one full battery
+/// cycle of the active loop, so one-off setup is not counted
+const quint32 ALLOC_CHECK_WARMUP_TICKS = 2 * 99;
+
+/// minimum time between state updates to the GUI (msec), around one display frame
+const int STATE_FRAME_MS = 33;
+
 HandControlThread::HandControlThread(QObject *parent) :
     QThread(parent)
 {
@@ -61,37 +129,262 @@ HandControlThread::HandControlThread(QObject *parent) :
         currPositionSample[i] = 0;
         batteryLevel = 0;
         
-        pwmFileDescriptors[i] = -1;
+        m_pwm[i] = NULL;
         
         pwmState[i] = PWM_NORMAL;
     }
+
+    m_idleMode = true;
+    m_verbose = false;
+    m_wakeRequested = false;
+    memset(&m_idleStats, 0, sizeof(m_idleStats));
+
+    m_history = new SampleHistory;
+    m_clock = new RealTimeClock;
+    m_rig = NULL;
+    m_runTimeUs = 0;
+    m_tick = 0;
+    m_idling = false;
+    m_secondTick = false;
+    m_loopCount = 0;
+    m_idleTickCount = 0;
+    m_serviceDueUs = 0;
+    m_idleStartUs = 0;
+    m_startUs = 0;
+    m_recorder = NULL;
+    m_replay = NULL;
+    m_commandPending = false;
+
+    m_stallSamples = DEFAULT_STALL_SAMPLES;
+    m_stallMinProgress = DEFAULT_STALL_MIN_PROGRESS;
+    m_positionIncreasingDir = FINGER_DIR_OPEN;
+    m_endStopsEnabled = false;
+    m_endStopMin = 0;
+    m_endStopMax = 0xffff;
+    memset(&m_limitStats, 0, sizeof(m_limitStats));
+
+    m_calibration = new PositionCalibration;
+    m_calibrationRequested = false;
+    m_calibrating = false;
+
+    m_heartbeatWindowMs = 0;
+    m_heartbeatRampMs = 0;
+    m_heartbeatRampTicks = 0;
+    m_keepAlivePending = false;
+    m_windowStartUs = -1;
+    m_deadmanRamping = false;
+    m_rampStep = 0;
+    memset(&m_deadmanStats, 0, sizeof(m_deadmanStats));
+    memset(&m_pwmStats, 0, sizeof(m_pwmStats));
+
+    m_battNominal = SIM_BATTERY_FULL;
+    m_battMaxGain = 0;
+    m_battCurvePoints = 0;
+    m_battFiltered = -1;
+    m_driveGain = BATT_UNITY_GAIN;
+
+    m_sequenceRequested = false;
+    m_pendingSequence = new MotionSequence;
+    m_sequence = new MotionSequence;
+    m_sequenceRunning = false;
+    m_seqStep = 0;
+    m_seqStepStarted = false;
+    m_seqStepTicks = 0;
+    m_seqDwellTicks = 0;
+    memset(m_seqRepeatsLeft, 0, sizeof(m_seqRepeatsLeft));
+    m_seqStepStartUs = 0;
+    m_seqLastStep = -1;
+    m_seqLastStepMs = 0;
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        m_seqMoveUp[i] = false;
+        m_stallRefPosition[i] = 0;
+        m_stallCount[i] = 0;
+        m_calState[i] = CAL_DONE;
+        m_lastRawSample[i] = 0;
+        m_simPosition[i] = 0;
+        m_simTravel[i] = 0;
+        m_pwmOutput[i] = 0;
+        m_rampStart[i] = 0;
+        m_calCount[i] = 0;
+    }
+
+#ifdef Q_WS_QWS
+    m_simulated = false;
+#else
+    m_simulated = true;
+#endif
+
+    m_lastSampleUs = 0;
+    m_firstSampleTaken = false;
+    m_stateDirty = false;
+    m_stateFresh = false;
+    memset(&m_state, 0, sizeof(m_state));
+    memset(&m_updateStats, 0, sizeof(m_updateStats));
+    memset(&m_loopStats, 0, sizeof(m_loopStats));
+
+    m_stateFd[0] = -1;
+    m_stateFd[1] = -1;
+
+#ifdef Q_OS_UNIX
+    // neither end may block, the control thread must not wait on the GUI
+    if (pipe(m_stateFd) == 0)
+    {
+        fcntl(m_stateFd[0], F_SETFL, O_NONBLOCK);
+        fcntl(m_stateFd[1], F_SETFL, O_NONBLOCK);
+    }
+    else
+    {
+        qDebug("HandControlThread: no state pipe, errno = %d", errno);
+        m_stateFd[0] = -1;
+        m_stateFd[1] = -1;
+    }
+#endif
  }
 
 HandControlThread::~HandControlThread()
 {
-}
-
-bool HandControlThread::startThread()
-{
-	if (isRunning())
-		return false;
+    delete m_history;
+    // a rig hand uses the rig's clock
+    if (!m_rig)
+        delete m_clock;
+    delete m_recorder;
+    delete m_replay;
+    delete m_calibration;
+    delete m_pendingSequence;
+    delete m_sequence;
 
-#ifdef Q_QS_QWS
-    // open pwm files
     for (int i = 0; i < NUM_FINGERS; i++)
     {
-        pwmFileDescriptors[i] = open(PWM_DEVICES[i], O_RDWR);
-        if (pwmFileDescriptors[i] < 0)
-        {
-            qDebug("HandControlThread::run: Could not open %s", PWM_DEVICES[i]);
-            closeFiles();
-            return false;
-        }
+        delete m_pwm[i];
+    }
+
+#ifdef Q_OS_UNIX
+    if (m_stateFd[0] >= 0)
+    {
+        close(m_stateFd[0]);
+        close(m_stateFd[1]);
     }
+#endif
+}
+
+void HandControlThread::SetClock(HandClock* iClock)
+{
+    if (IsControlLoopRunning() || m_rig)
+        return;
+
+    delete m_clock;
+    m_clock = iClock;
+}
+
+void HandControlThread::SetSimulated(bool iSimulated)
+{
+    if (IsControlLoopRunning())
+        return;
+
+#ifdef Q_WS_QWS
+    m_simulated = iSimulated;
 #else
-	qDebug("Opening pwm file handles");
+    Q_UNUSED(iSimulated);
 #endif
+}
+
+void HandControlThread::SetDevices(const HandDevices& iDevices)
+{
+    if (IsControlLoopRunning())
+        return;
+
+    m_devices = iDevices;
+}
+
+void HandControlThread::SetRunTime(qint64 iRunTimeMs)
+{
+    m_runTimeUs = iRunTimeMs * 1000;
+}
+
+bool HandControlThread::SetRecordFile(const QString& iPath)
+{
+    if (IsControlLoopRunning())
+        return false;
+
+    delete m_recorder;
+    m_recorder = new HandTrace;
+
+    if (!m_recorder->openForRecord(iPath))
+    {
+        delete m_recorder;
+        m_recorder = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool HandControlThread::SetReplayFile(const QString& iPath)
+{
+    if (IsControlLoopRunning())
+        return false;
+
+    delete m_replay;
+    m_replay = new HandTrace;
+    m_replayFile = iPath;
+
+    // the trace stands in for the hand
+    m_simulated = true;
+
+    return true;
+}
+
+int HandControlThread::ReplayMismatches()
+{
+    if (!m_replay)
+        return 0;
+
+    return m_replay->mismatches();
+}
+
+bool HandControlThread::IsControlLoopRunning()
+{
+    return isRunning() || (m_rig && m_rig->isRunning());
+}
+
+QThread* HandControlThread::ControlThread()
+{
+    if (m_rig)
+        return m_rig;
+
+    return this;
+}
+
+/// opens the devices and starts the control loop, in a rig the loop is started
+/// with the rig (see HandRig::startRig)
+bool HandControlThread::startThread()
+{
+	if (IsControlLoopRunning())
+		return false;
+
+	// the devices are opened by the control thread, see BringUp
+	m_bringUpTimer.start();
+	m_firstSampleTaken = false;
 	m_done = false;
+	m_wakeRequested = false;
+	m_commandPending = false;
+	m_calibrationRequested = false;
+	m_calibrating = false;
+	m_sequenceRequested = false;
+	m_sequenceRunning = false;
+	m_battFiltered = -1;
+	m_driveGain = BATT_UNITY_GAIN;
+	m_keepAlivePending = false;
+	m_windowStartUs = -1;
+	m_deadmanRamping = false;
+	m_tick = 0;
+	m_stateFresh = false;
+	m_lastPublishUs = -1;
+
+	if (m_rig)
+		return true;
 
 	start();
 
@@ -105,42 +398,193 @@ void HandControlThread::stopThread()
 	int i;
 
 	m_done = true;
+	WakeControlLoop();
 
-	for (i = 0; i < 10; i++) {
+	// a rig hand's loop stops with the rig
+	for (i = 0; i < 10 && !m_rig; i++) {
 		wait(100);
 
 		if (!isRunning())
 			break;
 	}
 
-	if (i == 10)
-		qDebug("Failed to stop HandControlThread");
-	
-	for (i = 0; i < NUM_FINGERS; i++)
-		SetPwmForFinger(0, i);
+	// the outputs cannot be closed under a running loop
+	if (i == 10) {
+		qDebug("HandControlThread is slow to stop, waiting for it");
+		wait();
+	}
+
+	// a rig hand's loop stops on the rig's next pass, which zeroes and closes
+	// its outputs there
+	if (m_rig && m_rig->isRunning())
+		return;
 
+	// zeroes every output on the way
 	closeFiles();
 }
 
 void HandControlThread::closeFiles()
 {
+	// the write counts and output values are read from the GUI
+	dataMutex.lock();
+	controlMutex.lock();
+
+	// not through SetPwmForFinger, these writes are not part of the loop's
+	// output even when a rig closes a hand on its own thread
 	for (int i = 0; i < NUM_FINGERS; i++) {
-		SetPwmForFinger(0, i);
-#ifdef Q_WS_QWS
-        if (pwmFileDescriptors[i] >= 0) {
-            close(pwmFileDescriptors[i]);
-            pwmFileDescriptors[i] = -1;
-        }
-#else
-		qDebug("Closing pwm file handles");
-#endif
+		if (m_pwm[i]) {
+			m_pwmOutput[i] = 0;
+			m_pwmStats.requested++;
+			m_pwmStats.written += m_pwm[i]->setDuty(0);
+
+			m_pwm[i]->close();
+			delete m_pwm[i];
+			m_pwm[i] = NULL;
+		}
 	}
+
+	controlMutex.unlock();
+	dataMutex.unlock();
 }
     
 
 /// set the drive level and implied direction
 /// iDriveLevel should be -100 - 100 where negative implies opening
 void HandControlThread::SetFingerDrive(qint16 iDriveLevel[NUM_FINGERS])
+{
+    // when replaying, the commands come from the trace
+    if (m_replay)
+    {
+        return;
+    }
+
+    // leave the command for the control loop so it is applied on a known tick;
+    // the loop applies a drive before a calibration or sequence, so one asked
+    // for before this has to go here or it would start after it
+    commandMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        m_pendingDrive[i] = iDriveLevel[i];
+    }
+    m_commandPending = true;
+    m_calibrationRequested = false;
+    m_sequenceRequested = false;
+    commandMutex.unlock();
+
+    WakeControlLoop();
+}
+
+/// picks up the command for this tick, from SetFingerDrive or the replayed trace
+void HandControlThread::ApplyPendingCommand()
+{
+    qint16 drive[NUM_FINGERS];
+    bool pending;
+    bool calibrate;
+    bool sequence;
+    bool keepAlive;
+
+    if (m_replay)
+    {
+        pending = m_replay->commandForTick(m_tick, drive);
+        calibrate = m_replay->calibrationForTick(m_tick);
+        sequence = m_replay->sequenceForTick(m_tick);
+        keepAlive = m_replay->keepAliveForTick(m_tick);
+    }
+    else
+    {
+        commandMutex.lock();
+        pending = m_commandPending;
+        calibrate = m_calibrationRequested;
+        sequence = m_sequenceRequested;
+        keepAlive = m_keepAlivePending;
+        for (int i = 0; i < NUM_FINGERS; i++)
+        {
+            drive[i] = m_pendingDrive[i];
+        }
+        m_commandPending = false;
+        m_calibrationRequested = false;
+        m_sequenceRequested = false;
+        m_keepAlivePending = false;
+        commandMutex.unlock();
+    }
+
+    if (keepAlive)
+    {
+        if (m_recorder)
+        {
+            m_recorder->recordKeepAlive(m_tick);
+        }
+
+        // a ramp already started carries on to zero, only a command stops it
+        m_windowStartUs = -1;
+    }
+
+    if (pending)
+    {
+        if (m_recorder)
+        {
+            m_recorder->recordCommand(m_tick, drive);
+        }
+
+        // the operator has taken over
+        if (m_calibrating)
+        {
+            EndCalibration(false);
+        }
+
+        if (m_sequenceRunning)
+        {
+            EndSequence(false);
+        }
+
+        m_windowStartUs = -1;
+        m_deadmanRamping = false;
+
+        ApplyFingerDrive(drive);
+    }
+
+    if (calibrate)
+    {
+        if (m_recorder)
+        {
+            m_recorder->recordCalibration(m_tick);
+        }
+
+        if (m_sequenceRunning)
+        {
+            EndSequence(false);
+        }
+
+        BeginCalibration();
+    }
+
+    if (sequence)
+    {
+        if (m_recorder)
+        {
+            m_recorder->recordSequence(m_tick);
+        }
+
+        if (m_calibrating)
+        {
+            EndCalibration(false);
+        }
+
+        if (m_sequenceRunning)
+        {
+            EndSequence(false);
+        }
+
+        // a copy of a fixed size table, so no allocation
+        commandMutex.lock();
+        *m_sequence = *m_pendingSequence;
+        commandMutex.unlock();
+
+        BeginSequence();
+    }
+}
+
+void HandControlThread::ApplyFingerDrive(qint16* iDriveLevel)
 {
     dataMutex.lock();
     controlMutex.lock();
@@ -171,7 +615,7 @@ void HandControlThread::SetFingerDrive(qint16 iDriveLevel[NUM_FINGERS])
                 // change process run its course
                 if (pwmState[i] == PWM_NORMAL)
                 {
-                    SetPwmForFinger(abs(fingerPwmLevel[i]), i);
+                    SetPwmForFinger(CompensatedPwm(fingerPwmLevel[i]), i);
                 }
             }
             else
@@ -236,169 +680,1626 @@ void HandControlThread::GetFingerPos(quint16* oFingerPos)
 }
 
 
-void HandControlThread::SetFingerPos(quint16* iFingerPos)
+/// copies up to iMax finger samples newer than iSinceSeq into oSamples, oldest first
+/// returns the number copied
+int HandControlThread::fetchSince(quint32 iSinceSeq, FingerSample* oSamples, int iMax)
 {
-    dataMutex.lock();
-    for (int i = 0; i < NUM_FINGERS; i++)
-    {
-        currPositionSample[i] = iFingerPos[i];
-    }
-    
-    dataMutex.unlock();
-    
-    emit fingerPositionUpdated();
+    return m_history->fetchSince(iSinceSeq, oSamples, iMax);
 }
 
-void HandControlThread::SetBatteryLevel(quint16 iBatteryLevel)
+void HandControlThread::SetIdleMode(bool iEnable)
+{
+    m_idleMode = iEnable;
+    WakeControlLoop();
+}
+
+/// gets the idle mode statistics
+/// idle wakeups/sec is oStats->idleWakeups * 1000 / oStats->idleTimeMs
+void HandControlThread::GetIdleStats(IdleStats* oStats)
 {
     dataMutex.lock();
-    batteryLevel = iBatteryLevel;
+    *oStats = m_idleStats;
     dataMutex.unlock();
-    
-    emit batteryLevelUpdated();
 }
 
-void HandControlThread::SetPwmForFinger(int iValue, int iFingerNum)
+bool HandControlThread::TakeState(HandState* oState)
 {
-    // use the built-in PWMs
-    char buf[10];
-    sprintf(buf, "%d", iValue);
+#ifdef Q_OS_UNIX
+    // emptied before the snapshot is taken, so a snapshot published meanwhile
+    // leaves a byte behind rather than being missed
+    char buffer[16];
 
-#ifdef Q_QS_QWS
-    ssize_t writeRet = write(pwmFileDescriptors[iFingerNum], buf, strlen(buf));
-    if (writeRet < 0)
+    while ((m_stateFd[0] >= 0) && (read(m_stateFd[0], buffer, sizeof(buffer)) > 0))
     {
-        qDebug("HandControlThread::SetPwmForFinger Error Writing, errno = %d", errno);
     }
-#else
-    qDebug("Finger[%d]: set PWM = %d", iFingerNum, iValue);
 #endif
-}
 
-void HandControlThread::SetDirForFinger(FingerDir iFingerDir, int iFingerNum)
-{
-    if (iFingerNum < NUM_FINGERS)
+    dataMutex.lock();
+    bool fresh = m_stateFresh;
+    if (fresh)
     {
-        char value;
-        if (FINGER_DIR_OPEN == iFingerDir)
-        {
-            value = '1';
-        }
-        else
-        {
-            value = '0';
-        }
-
-#ifdef Q_WS_QWS
-        int fd = open(GPIO_DEVICES[iFingerNum], O_RDWR);
+        *oState = m_state;
+        m_stateFresh = false;
+    }
+    dataMutex.unlock();
 
-        if (fd < 0)
-		{
-            qDebug("HandControlThread::run: Could not open %s", GPIO_DEVICES[iFingerNum]);
-			return;
-        }
-#endif
+    return fresh;
+}
 
-        qDebug("Finger[%d]: set GPIO = %c", iFingerNum, value);
+int HandControlThread::StateNotifierFd()
+{
+    return m_stateFd[0];
+}
 
-#ifdef Q_WS_QWS
-        ssize_t writeRet = write(fd, &value, 1);
-        if (writeRet < 0)
-        {
-            qDebug("HandControlThread::SetDirForFinger Error Writing, errno = %d", errno);
-        }
+void HandControlThread::SetVerbose(bool iVerbose)
+{
+    m_verbose = iVerbose;
+}
 
-		close(fd);
-#endif
-    }
-    else
-    {
-        qDebug("HandControlThread::SetPwmForFinger: Invalid Finger Index = %d", iFingerNum);
-    }
+int HandControlThread::LoopAllocations()
+{
+    return AllocationCheck::count();
 }
 
-void HandControlThread::UpdatePwmControlStates()
+void HandControlThread::GetUpdateStats(UpdateStats* oStats)
 {
     dataMutex.lock();
+    *oStats = m_updateStats;
+    dataMutex.unlock();
+}
+
+void HandControlThread::SetStallDetection(int iSamples, int iMinProgress)
+{
     controlMutex.lock();
+    m_stallSamples = iSamples;
+    m_stallMinProgress = iMinProgress;
+    controlMutex.unlock();
+}
 
-    for (int i = 0; i < NUM_FINGERS; i++)
-    {
-        switch (pwmState[i])
-        {
-            case (PWM_NORMAL):
-                // do nothing - pwm value will be set in SetFingerDrive
-                break;
+void HandControlThread::SetEndStops(quint16 iMin, quint16 iMax)
+{
+    controlMutex.lock();
+    m_endStopsEnabled = true;
+    m_endStopMin = iMin;
+    m_endStopMax = iMax;
+    controlMutex.unlock();
+}
+
+void HandControlThread::SetPositionDirection(FingerDir iIncreasingDir)
+{
+    if (IsControlLoopRunning())
+        return;
+
+    m_positionIncreasingDir = iIncreasingDir;
+}
+
+void HandControlThread::GetLimitStats(LimitStats* oStats)
+{
+    dataMutex.lock();
+    *oStats = m_limitStats;
+    dataMutex.unlock();
+}
+
+void HandControlThread::SetCalibrationFile(const QString& iPath)
+{
+    if (IsControlLoopRunning())
+        return;
+
+    m_calibrationFile = iPath;
+}
+
+void HandControlThread::StartCalibration()
+{
+    // started on the control thread's tick like any other command, in place
+    // of a sequence still waiting for it
+    commandMutex.lock();
+    m_calibrationRequested = true;
+    m_sequenceRequested = false;
+    commandMutex.unlock();
+
+    WakeControlLoop();
+}
+
+bool HandControlThread::SaveCalibration()
+{
+    // a replay must not overwrite the real calibration
+    if (m_replay)
+    {
+        return true;
+    }
+
+    if (m_calibrationFile.isEmpty())
+    {
+        return false;
+    }
+
+    return m_calibration->save(m_calibrationFile);
+}
+
+void HandControlThread::SetBatteryCompensation(quint16 iNominal, int iMaxGain)
+{
+    if (IsControlLoopRunning())
+        return;
+
+    m_battNominal = iNominal;
+    m_battMaxGain = iMaxGain * 10;
+    m_battCurvePoints = 0;
+}
+
+bool HandControlThread::SetBatteryCurve(const quint16* iLevels, const quint16* iGain, int iPoints)
+{
+    if (IsControlLoopRunning() || (iPoints < 1) || (iPoints > BATT_MAX_CURVE_POINTS))
+        return false;
+
+    for (int i = 1; i < iPoints; i++)
+    {
+        if (iLevels[i] <= iLevels[i - 1])
+        {
+            qDebug("HandControlThread: battery curve levels must ascend");
+            return false;
+        }
+    }
+
+    for (int i = 0; i < iPoints; i++)
+    {
+        m_battCurveLevel[i] = iLevels[i];
+        m_battCurveGain[i] = iGain[i];
+    }
+
+    m_battCurvePoints = iPoints;
+
+    return true;
+}
+
+void HandControlThread::SetHeartbeat(int iWindowMs, int iRampMs)
+{
+    if (IsControlLoopRunning())
+        return;
+
+    m_heartbeatWindowMs = iWindowMs;
+    m_heartbeatRampMs = iRampMs;
+    m_heartbeatRampTicks = (iRampMs + TICK_MS - 1) / TICK_MS;
+}
+
+void HandControlThread::KeepAlive()
+{
+    // when replaying, the keepalives come from the trace
+    if (m_replay)
+    {
+        return;
+    }
+
+    // a stopped hand has nothing to time out, so there is no need to wake it
+    commandMutex.lock();
+    m_keepAlivePending = true;
+    commandMutex.unlock();
+}
+
+void HandControlThread::GetPwmStats(PwmStats* oStats)
+{
+    dataMutex.lock();
+    *oStats = m_pwmStats;
+    dataMutex.unlock();
+}
+
+void HandControlThread::GetDeadmanStats(DeadmanStats* oStats)
+{
+    dataMutex.lock();
+    *oStats = m_deadmanStats;
+    dataMutex.unlock();
+}
+
+void HandControlThread::RunSequence(const MotionSequence& iSequence)
+{
+    commandMutex.lock();
+    *m_pendingSequence = iSequence;
+
+    // when replaying, the trace says when it starts
+    if (!m_replay)
+    {
+        m_sequenceRequested = true;
+        m_calibrationRequested = false;
+    }
+    commandMutex.unlock();
+
+    WakeControlLoop();
+}
+
+void HandControlThread::GetLoopStats(LoopStats* oStats)
+{
+    dataMutex.lock();
+    *oStats = m_loopStats;
+    dataMutex.unlock();
+}
+
+void HandControlThread::ResetLoopStats()
+{
+    dataMutex.lock();
+    memset(&m_loopStats, 0, sizeof(m_loopStats));
+    dataMutex.unlock();
+}
+
+/// updates the snapshot for TakeState if anything changed and a display frame has
+/// passed since the last one
+void HandControlThread::PublishState()
+{
+    if (!m_stateDirty)
+    {
+        return;
+    }
+
+    if ((m_lastPublishUs >= 0) && ((m_clock->nowUs() - m_lastPublishUs) < STATE_FRAME_MS * 1000))
+    {
+        return;
+    }
+
+    quint32 sampleSeq = m_history->latestSeq();
+
+    // the GUI takes whichever snapshot is newest when it next wakes
+    dataMutex.lock();
+    bool notify = !m_stateFresh;
+    m_state.sampleSeq = sampleSeq;
+    m_state.timestampUs = m_lastSampleUs;
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        m_state.position[i] = currPositionSample[i];
+        if (fingerDirs[i] == FINGER_DIR_OPEN)
+            m_state.drive[i] = fingerPwmLevel[i];
+        else
+            m_state.drive[i] = -fingerPwmLevel[i];
+    }
+    m_state.positionMax = m_calibration->isCalibrated() ? 100 : CAL_TABLE_SIZE - 1;
+    m_state.batteryLevel = batteryLevel;
+    m_state.driveGain = m_driveGain / 10;
+    m_state.sequenceStep = m_sequenceRunning ? m_seqStep : -1;
+    m_state.sequenceLastStep = m_seqLastStep;
+    m_state.sequenceLastStepMs = m_seqLastStepMs;
+    m_stateFresh = true;
+    m_updateStats.statesPublished++;
+    dataMutex.unlock();
+
+    m_stateDirty = false;
+    m_lastPublishUs = m_clock->nowUs();
+
+#ifdef Q_OS_UNIX
+    // one byte per snapshot the GUI has yet to take, so the pipe never fills
+    // and the GUI only wakes for something new
+    if (notify && (m_stateFd[1] >= 0))
+    {
+        ssize_t written = write(m_stateFd[1], "s", 1);
+        Q_UNUSED(written);
+    }
+#else
+    Q_UNUSED(notify);
+#endif
+}
+
+void HandControlThread::SetFingerPos(quint16* iFingerPos)
+{
+    FingerSample sample;
+    sample.timestampUs = m_clock->nowUs();
+
+    dataMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        currPositionSample[i] = iFingerPos[i];
+
+        sample.position[i] = iFingerPos[i];
+        if (fingerDirs[i] == FINGER_DIR_OPEN)
+            sample.drive[i] = fingerPwmLevel[i];
+        else
+            sample.drive[i] = -fingerPwmLevel[i];
+    }
+
+    m_lastSampleUs = sample.timestampUs;
+    m_updateStats.samplesProduced++;
+    dataMutex.unlock();
+
+    if (!m_firstSampleTaken)
+    {
+        m_firstSampleTaken = true;
+        qDebug("HandControlThread: first position sample %lld ms after start", m_bringUpTimer.elapsed());
+    }
+
+    // only the control thread appends, so no lock is needed for the history
+    m_history->append(sample);
+
+    m_stateDirty = true;
+}
+
+void HandControlThread::SetBatteryLevel(quint16 iBatteryLevel)
+{
+    dataMutex.lock();
+    batteryLevel = iBatteryLevel;
+    m_updateStats.samplesProduced++;
+    dataMutex.unlock();
+
+    m_stateDirty = true;
+}
+
+/// records or checks an output written by the control loop
+void HandControlThread::TraceOutput(char iType, int iFingerNum, int iValue)
+{
+    // writes made while stopping are not part of the control loop's output
+    if (QThread::currentThread() != ControlThread())
+    {
+        return;
+    }
+
+    if (m_recorder)
+    {
+        m_recorder->recordOutput(m_tick, iType, iFingerNum, iValue);
+    }
+
+    if (m_replay)
+    {
+        m_replay->checkOutput(m_tick, iType, iFingerNum, iValue);
+    }
+}
+
+void HandControlThread::SetPwmForFinger(int iValue, int iFingerNum)
+{
+    TraceOutput('W', iFingerNum, iValue);
+
+    m_pwmOutput[iFingerNum] = iValue;
+
+    if (m_verbose)
+        qDebug("Finger[%d]: set PWM = %d", iFingerNum, iValue);
+
+    // the output only writes what changes
+    int writes = m_pwm[iFingerNum] ? m_pwm[iFingerNum]->setDuty(iValue) : 0;
+
+    m_pwmStats.requested++;
+    m_pwmStats.written += writes;
+}
+
+void HandControlThread::SetDirForFinger(FingerDir iFingerDir, int iFingerNum)
+{
+    if (iFingerNum < NUM_FINGERS)
+    {
+        char value;
+        if (FINGER_DIR_OPEN == iFingerDir)
+        {
+            value = '1';
+        }
+        else
+        {
+            value = '0';
+        }
+
+        TraceOutput('G', iFingerNum, value - '0');
+
+        if (m_simulated)
+        {
+            if (m_verbose)
+                qDebug("Finger[%d]: set GPIO = %c", iFingerNum, value);
+            return;
+        }
+
+#ifdef Q_WS_QWS
+        int fd = open(m_devices.gpio[iFingerNum].constData(), O_RDWR);
+
+        if (fd < 0)
+		{
+            qDebug("HandControlThread::run: Could not open %s", m_devices.gpio[iFingerNum].constData());
+			return;
+        }
+#endif
+
+        if (m_verbose)
+            qDebug("Finger[%d]: set GPIO = %c", iFingerNum, value);
+
+#ifdef Q_WS_QWS
+        ssize_t writeRet = write(fd, &value, 1);
+        if (writeRet < 0)
+        {
+            qDebug("HandControlThread::SetDirForFinger Error Writing, errno = %d", errno);
+        }
+
+		close(fd);
+#endif
+    }
+    else
+    {
+        qDebug("HandControlThread::SetPwmForFinger: Invalid Finger Index = %d", iFingerNum);
+    }
+}
+
+void HandControlThread::UpdatePwmControlStates()
+{
+    dataMutex.lock();
+    controlMutex.lock();
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        switch (pwmState[i])
+        {
+            case (PWM_NORMAL):
+                // do nothing - pwm value will be set in SetFingerDrive
+                break;
             case (PRE_WAIT_TO_CHANGE_DIR):
-                qDebug("PRE_WAIT_TO_CHANGE_DIR: finger%d", i);
+                if (m_verbose)
+                    qDebug("PRE_WAIT_TO_CHANGE_DIR: finger%d", i);
                 pwmState[i] = RXED_WAIT_TO_CHANGE_DIR;
                 break;
             case (RXED_WAIT_TO_CHANGE_DIR):
-                qDebug("RXED_WAIT_TO_CHANGE_DIR: finger%d", i);
+                if (m_verbose)
+                    qDebug("RXED_WAIT_TO_CHANGE_DIR: finger%d", i);
                 pwmState[i] = PRE_WAIT_TO_SET_PWR;
                 SetDirForFinger(fingerDirs[i], i);
                 break;
             case (PRE_WAIT_TO_SET_PWR):
-                qDebug("PRE_WAIT_TO_SET_PWR: finger%d", i);
+                if (m_verbose)
+                    qDebug("PRE_WAIT_TO_SET_PWR: finger%d", i);
                 pwmState[i] = PWM_NORMAL;
-                SetPwmForFinger(fingerPwmLevel[i], i);
+                SetPwmForFinger(CompensatedPwm(fingerPwmLevel[i]), i);
                 break;
         }
     }
-    
+    
+    controlMutex.unlock();
+    dataMutex.unlock();
+}
+
+/// true when every finger is stopped and no direction change is in progress
+bool HandControlThread::IsIdle()
+{
+    bool idle = true;
+
+    controlMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        if ((pwmState[i] != PWM_NORMAL) || (fingerPwmLevel[i] != 0))
+        {
+            idle = false;
+        }
+    }
+    controlMutex.unlock();
+
+    // a sequence may be dwelling or waiting with the drive off
+    return idle && !m_sequenceRunning;
+}
+
+void HandControlThread::WakeControlLoop()
+{
+    idleMutex.lock();
+    m_wakeRequested = true;
+    m_wakeTimer.start();
+    idleCondition.wakeOne();
+    idleMutex.unlock();
+
+    // a rig hand shares its rig's wait
+    if (m_rig)
+    {
+        m_rig->WakeRig();
+    }
+}
+
+/// one step of the control loop: take any new command, advance any running
+/// sequence, check the heartbeat, then advance the pwm state machine
+void HandControlThread::RunControlTick()
+{
+    m_tick++;
+    ApplyPendingCommand();
+    AdvanceSequence();
+    CheckHeartbeat();
+    UpdatePwmControlStates();
+}
+
+/// gets the schedule ready for the first Service() of a run
+void HandControlThread::PrepareRun()
+{
+    m_wallTimer.start();
+    m_startUs = m_clock->nowUs();
+
+    m_loopCount = 0;
+    m_idleTickCount = 0;
+    m_secondTick = false;
+
+    ScheduleLoop(m_startUs);
+}
+
+/// true at the top of the loop once the run time is up or the replay has ended
+bool HandControlThread::RunFinished()
+{
+    if (m_secondTick)
+    {
+        return false;
+    }
+
+    if (m_done)
+    {
+        return true;
+    }
+
+    if ((m_runTimeUs > 0) && ((m_clock->nowUs() - m_startUs) >= m_runTimeUs))
+    {
+        return true;
+    }
+
+    return (m_replay && m_replay->finished(m_tick));
+}
+
+/// true when the hand needs a Service() at iNowUs, either because its next tick
+/// is due or because it is idle and has been woken
+bool HandControlThread::IsServiceDue(qint64 iNowUs)
+{
+    if (iNowUs >= m_serviceDueUs)
+    {
+        return true;
+    }
+
+    if (!m_idling)
+    {
+        return false;
+    }
+
+    idleMutex.lock();
+    bool woken = m_wakeRequested || m_done;
+    m_wakeRequested = false;
+    idleMutex.unlock();
+
+    return woken;
+}
+
+qint64 HandControlThread::ServiceDueUs()
+{
+    return m_serviceDueUs;
+}
+
+/// blocks until the next Service() is due, only used when the hand has its own thread
+void HandControlThread::WaitForService()
+{
+    int waitMs = (m_serviceDueUs - m_clock->nowUs() + 999) / 1000;
+
+    if (!m_idling)
+    {
+        // ticks are not cut short by a new command, it waits for the next one
+        if (waitMs > 0)
+        {
+            m_clock->sleepMs(waitMs);
+        }
+        return;
+    }
+
+    // parks for up to one housekeeping tick, or until woken
+    idleMutex.lock();
+    if (!m_wakeRequested && !m_done && (waitMs > 0))
+    {
+        m_clock->waitMs(&idleCondition, &idleMutex, waitMs);
+    }
+    m_wakeRequested = false;
+    idleMutex.unlock();
+}
+
+/// picks the next step at the top of the loop: with all fingers stopped there is
+/// nothing for the state machine to do, so drop to a slow housekeeping tick until
+/// SetFingerDrive wakes us
+void HandControlThread::ScheduleLoop(qint64 iNowUs)
+{
+    if (m_idleMode && IsIdle())
+    {
+        m_idling = true;
+        m_idleStartUs = iNowUs;
+        m_serviceDueUs = iNowUs + (IDLE_TICK_MS * 1000);
+    }
+    else
+    {
+        m_idling = false;
+        m_serviceDueUs = iNowUs + (TICK_MS * 1000);
+    }
+}
+
+/// runs whatever the loop has due now and schedules the next step
+/// the loop is two pwm ticks of TICK_MS, then the periodic reads, or one
+/// housekeeping tick while idle
+void HandControlThread::Service()
+{
+    qint64 nowUs = m_clock->nowUs();
+
+    if (m_idling)
+    {
+        dataMutex.lock();
+        m_idleStats.idleWakeups++;
+        m_idleStats.idleTimeMs += (nowUs - m_idleStartUs) / 1000;
+        dataMutex.unlock();
+
+        m_tick++;
+        ApplyPendingCommand();
+        AdvanceSequence();
+
+        if (!IsIdle() || !m_idleMode)
+        {
+            // run the first active tick straight away rather than after a full sleep
+            UpdatePwmControlStates();
+
+            idleMutex.lock();
+            quint32 latencyUs = m_wakeTimer.nsecsElapsed() / 1000;
+            idleMutex.unlock();
+
+            dataMutex.lock();
+            m_idleStats.resumeCount++;
+            m_idleStats.lastResumeLatencyUs = latencyUs;
+            if (latencyUs > m_idleStats.maxResumeLatencyUs)
+            {
+                m_idleStats.maxResumeLatencyUs = latencyUs;
+            }
+            dataMutex.unlock();
+
+            m_loopCount = 0;
+            m_idleTickCount = 0;
+        }
+        else if (!m_done)
+        {
+            ReadFingerPositions();
+
+            if ((m_idleTickCount % IDLE_BATTERY_TICKS) == 0)
+            {
+                ReadBatteryLevel();
+            }
+
+            m_idleTickCount++;
+            if (m_idleTickCount >= IDLE_BATTERY_TICKS)
+            {
+                m_idleTickCount = 0;
+            }
+
+            PublishState();
+        }
+
+        ScheduleLoop(nowUs);
+        return;
+    }
+
+    // how late this tick is against its deadline
+    qint64 lateUs = nowUs - m_serviceDueUs;
+    if (lateUs < 0)
+    {
+        lateUs = 0;
+    }
+
+    dataMutex.lock();
+    m_loopStats.ticks++;
+    m_loopStats.totalLateUs += lateUs;
+    if (lateUs > m_loopStats.maxLateUs)
+    {
+        m_loopStats.maxLateUs = lateUs;
+    }
+    dataMutex.unlock();
+
+    RunControlTick();
+
+    if (!m_secondTick)
+    {
+        m_secondTick = true;
+        m_serviceDueUs = nowUs + (TICK_MS * 1000);
+        return;
+    }
+
+    m_secondTick = false;
+
+    // get finger positions one-third as often (around 33 Hz)
+    if ((m_loopCount % 3) == 0)
+    {
+        ReadFingerPositions();
+    }
+
+    // get battery level around once/second
+    if ((m_loopCount % 99) == 0)
+    {
+        ReadBatteryLevel();
+    }
+
+    PublishState();
+
+    // reset the loop count when it would be 99 the next round
+    m_loopCount++;
+    if (m_loopCount >= 99)
+    {
+        m_loopCount = 0;
+    }
+
+    ScheduleLoop(nowUs);
+}
+
+/// reads the trace and calibration, opens and checks the devices and takes the
+/// first samples, on the control thread so a slow device or a big file does not
+/// hold up the GUI; signals hardwareReady
+bool HandControlThread::BringUp()
+{
+    bool ok = true;
+
+    // the files are read here too, a trace can be many MB
+    if (m_replay && !m_replay->openForReplay(m_replayFile))
+    {
+        qDebug("HandControlThread::BringUp: Could not read %s", m_replayFile.toLocal8Bit().constData());
+        ok = false;
+    }
+
+    if (!m_calibrationFile.isEmpty() && !m_calibration->load(m_calibrationFile))
+    {
+        qDebug("HandControlThread: no position calibration, using raw samples");
+    }
+
+    // a trace carries the settings it ran with, so it replays without them
+    // being given again
+    TraceSettings settings;
+
+    if (ok && m_replay)
+    {
+        if (!m_replay->settings(&settings))
+        {
+            qDebug("HandControlThread: the trace has no settings, replaying with the current ones");
+        }
+        else if (!ApplyTraceSettings(settings))
+        {
+            ok = false;
+        }
+    }
+
+    if (m_recorder)
+    {
+        GetTraceSettings(&settings);
+        m_recorder->recordSettings(settings);
+    }
+
+    if (BringUpCancelled())
+    {
+        return false;
+    }
+
+    // the simulated hand gets outputs that write nothing, so the write counts
+    // mean the same on the desktop
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        delete m_pwm[i];
+
+        if (m_simulated)
+            m_pwm[i] = new PwmOutput;
+        else
+            m_pwm[i] = PwmOutput::create(m_devices.pwm[i], m_devices.pwmFrequencyHz);
+
+        if (!m_pwm[i]->open())
+        {
+            qDebug("HandControlThread::BringUp: Could not open %s", m_devices.pwm[i].constData());
+            ok = false;
+        }
+    }
+
+    if (BringUpCancelled())
+    {
+        return false;
+    }
+
+#ifdef Q_WS_QWS
+    // the rest are opened on each use, so only check they are there
+    for (int i = 0; i < NUM_FINGERS && !m_simulated; i++)
+    {
+        if (access(m_devices.gpio[i].constData(), W_OK) != 0)
+        {
+            qDebug("HandControlThread::BringUp: Could not open %s", m_devices.gpio[i].constData());
+            ok = false;
+        }
+    }
+
+    if (!m_simulated && (access(m_devices.fingerPositionAdc.constData(), R_OK) != 0))
+    {
+        qDebug("HandControlThread::BringUp: Could not open %s", m_devices.fingerPositionAdc.constData());
+        ok = false;
+    }
+
+    if (!m_simulated && (access(m_devices.batteryAdc.constData(), R_OK) != 0))
+    {
+        qDebug("HandControlThread::BringUp: Could not open %s", m_devices.batteryAdc.constData());
+        ok = false;
+    }
+#endif
+
+    if (BringUpCancelled())
+    {
+        return false;
+    }
+
+    if (ok)
+    {
+        // the GUI has a state to show as soon as it hears
+        ReadFingerPositions();
+        ReadBatteryLevel();
+        PublishState();
+    }
+
+    qDebug("HandControlThread: hardware %s in %lld ms", ok ? "ready" : "failed", m_bringUpTimer.elapsed());
+
+    emit hardwareReady(ok);
+
+    return ok;
+}
+
+/// stopThread can come in while a device is still being opened, in which case
+/// there is no one left to tell
+bool HandControlThread::BringUpCancelled()
+{
+    if (!m_done)
+    {
+        return false;
+    }
+
+    qDebug("HandControlThread: bring-up cancelled after %lld ms", m_bringUpTimer.elapsed());
+
+    return true;
+}
+
+void HandControlThread::GetTraceSettings(TraceSettings* oSettings)
+{
+    controlMutex.lock();
+    oSettings->stallSamples = m_stallSamples;
+    oSettings->stallMinProgress = m_stallMinProgress;
+    oSettings->endStopsEnabled = m_endStopsEnabled;
+    oSettings->endStopMin = m_endStopMin;
+    oSettings->endStopMax = m_endStopMax;
+    controlMutex.unlock();
+
+    oSettings->positionIncreasingDir = m_positionIncreasingDir;
+    oSettings->battNominal = m_battNominal;
+    oSettings->battMaxGain = m_battMaxGain / 10;
+    oSettings->battCurvePoints = m_battCurvePoints;
+
+    for (int i = 0; i < BATT_MAX_CURVE_POINTS; i++)
+    {
+        oSettings->battCurveLevel[i] = (i < m_battCurvePoints) ? m_battCurveLevel[i] : 0;
+        oSettings->battCurveGain[i] = (i < m_battCurvePoints) ? m_battCurveGain[i] : 0;
+    }
+
+    oSettings->heartbeatWindowMs = m_heartbeatWindowMs;
+    oSettings->heartbeatRampMs = m_heartbeatRampMs;
+    oSettings->calibrationChecksum = m_calibration->checksum();
+}
+
+/// on the control thread before the loop starts, which is why the setters
+/// (which refuse while running) are not used; false if the trace needs a
+/// calibration other than the one loaded
+bool HandControlThread::ApplyTraceSettings(const TraceSettings& iSettings)
+{
+    quint32 checksum = m_calibration->checksum();
+
+    if (iSettings.calibrationChecksum != checksum)
+    {
+        qDebug("HandControlThread: the trace was recorded with calibration %08x, %08x is loaded,"
+               " give the -calfile it was recorded with", iSettings.calibrationChecksum, checksum);
+        return false;
+    }
+
+    controlMutex.lock();
+    m_stallSamples = iSettings.stallSamples;
+    m_stallMinProgress = iSettings.stallMinProgress;
+    m_endStopsEnabled = iSettings.endStopsEnabled;
+    m_endStopMin = iSettings.endStopMin;
+    m_endStopMax = iSettings.endStopMax;
+    controlMutex.unlock();
+
+    m_positionIncreasingDir = iSettings.positionIncreasingDir;
+    m_battNominal = iSettings.battNominal;
+    m_battMaxGain = iSettings.battMaxGain * 10;
+    m_battCurvePoints = iSettings.battCurvePoints;
+
+    for (int i = 0; i < m_battCurvePoints; i++)
+    {
+        m_battCurveLevel[i] = iSettings.battCurveLevel[i];
+        m_battCurveGain[i] = iSettings.battCurveGain[i];
+    }
+
+    m_heartbeatWindowMs = iSettings.heartbeatWindowMs;
+    m_heartbeatRampMs = iSettings.heartbeatRampMs;
+    m_heartbeatRampTicks = (m_heartbeatRampMs + TICK_MS - 1) / TICK_MS;
+
+    qDebug("HandControlThread: replaying with the settings in the trace");
+
+    return true;
+}
+
+/// reports on and closes out a run
+void HandControlThread::FinishRun()
+{
+    qint64 clockMs = (m_clock->nowUs() - m_startUs) / 1000;
+    qint64 wallMs = m_wallTimer.elapsed();
+
+    qDebug("HandControlThread ran %lld ms of clock time in %lld ms wall time (%.1fx)",
+           clockMs, wallMs, (double) clockMs / (wallMs > 0 ? wallMs : 1));
+
+    if (m_recorder)
+    {
+        m_recorder->close();
+    }
+
+    if (m_replay)
+    {
+        m_replay->report();
+    }
+
+    if (AllocationCheck::enabled())
+    {
+        qDebug("HandControlThread: %d heap allocations in the control loop after tick %u",
+               AllocationCheck::count(), ALLOC_CHECK_WARMUP_TICKS);
+    }
+}
+
+void HandControlThread::run()
+{
+    if (!BringUp())
+    {
+        return;
+    }
+
+    PrepareRun();
+
+    while (!RunFinished())
+    {
+        WaitForService();
+        Service();
+
+        // from here on the loop should not touch the heap
+        if (m_tick == ALLOC_CHECK_WARMUP_TICKS)
+        {
+            AllocationCheck::watchCurrentThread();
+        }
+    }
+
+    AllocationCheck::stop();
+
+    FinishRun();
+}
+
+void HandControlThread::ReadFingerPositions()
+{
+	quint16 samples[NUM_FINGERS];
+
+    m_sampleTimer.start();
+
+    if (m_replay)
+    {
+        if (!m_replay->positionsForTick(m_tick, samples))
+            return;
+    }
+    else if (m_simulated)
+    {
+        SimulateFingerPositions(samples);
+    }
+    else if (!ReadAdcFingerPositions(samples))
+    {
+        return;
+    }
+
+    if (m_recorder)
+    {
+        m_recorder->recordPositions(m_tick, samples);
+    }
+
+    quint16 positions[NUM_FINGERS];
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        m_lastRawSample[i] = samples[i];
+        positions[i] = m_calibration->position(i, samples[i]);
+    }
+
+    SetFingerPos(positions);
+
+    // the sweep drives into the ends on purpose
+    if (m_calibrating)
+    {
+        RunCalibration(samples);
+    }
+    else
+    {
+        CheckFingerLimits(positions);
+    }
+}
+
+/// signed drive level as given to SetFingerDrive
+static qint16 SignedDrive(FingerDir iDir, qint16 iLevel)
+{
+    return (iDir == FINGER_DIR_OPEN) ? iLevel : -iLevel;
+}
+
+void HandControlThread::BeginCalibration()
+{
+    qint16 drive[NUM_FINGERS];
+    FingerDir lowDir = (m_positionIncreasingDir == FINGER_DIR_OPEN) ? FINGER_DIR_CLOSE : FINGER_DIR_OPEN;
+
+    qDebug("HandControlThread: calibration started");
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        m_calState[i] = CAL_SEEK_LOW;
+        m_calMoving[i] = false;
+        m_calRefRaw[i] = m_lastRawSample[i];
+        m_calStallCount[i] = 0;
+        m_calLastProgress[i] = 0;
+        m_calCount[i] = 0;
+
+        drive[i] = SignedDrive(lowDir, CAL_DRIVE_LEVEL);
+    }
+
+    m_calibrating = true;
+    ApplyFingerDrive(drive);
+}
+
+/// steps each finger's sweep on a new raw position sample
+void HandControlThread::RunCalibration(quint16* iRawSamples)
+{
+    qint16 drive[NUM_FINGERS];
+    bool changed = false;
+    bool finished = true;
+
+    controlMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        drive[i] = SignedDrive(fingerDirs[i], fingerPwmLevel[i]);
+    }
+    controlMutex.unlock();
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        quint16 raw = iRawSamples[i];
+        bool progress = (abs(raw - m_calRefRaw[i]) >= CAL_MIN_PROGRESS);
+
+        if (m_calState[i] == CAL_SWEEP)
+        {
+            // time only counts from when the finger starts moving
+            if (!m_calMoving[i])
+            {
+                m_calCount[i] = 0;
+                m_calMoving[i] = progress;
+            }
+
+            if (m_calCount[i] >= CAL_MAX_SAMPLES)
+            {
+                qDebug("Finger[%d]: calibration sweep never reached the end", i);
+                m_calState[i] = CAL_FAILED;
+                drive[i] = 0;
+                changed = true;
+                continue;
+            }
+
+            m_calSamples[i][m_calCount[i]++] = raw;
+        }
+
+        if ((m_calState[i] == CAL_SEEK_LOW) || (m_calState[i] == CAL_SWEEP))
+        {
+            if (progress)
+            {
+                m_calRefRaw[i] = raw;
+                m_calStallCount[i] = 0;
+                m_calLastProgress[i] = m_calCount[i] - 1;
+            }
+            else if (++m_calStallCount[i] >= CAL_STALL_SAMPLES)
+            {
+                m_calStallCount[i] = 0;
+                changed = true;
+
+                if (m_calState[i] == CAL_SEEK_LOW)
+                {
+                    // at the low end, now sweep across
+                    m_calState[i] = CAL_SWEEP;
+                    m_calMoving[i] = false;
+                    drive[i] = SignedDrive(m_positionIncreasingDir, CAL_DRIVE_LEVEL);
+                }
+                else
+                {
+                    // at the high end, the samples after the last progress are the stall
+                    drive[i] = 0;
+
+                    if (m_calMoving[i] && m_calibration->build(i, m_calSamples[i], m_calLastProgress[i] + 1))
+                    {
+                        m_calState[i] = CAL_DONE;
+                        qDebug("Finger[%d]: calibrated over %d samples, raw %d - %d", i, m_calLastProgress[i] + 1,
+                               m_calSamples[i][0], m_calSamples[i][m_calLastProgress[i]]);
+                    }
+                    else
+                    {
+                        m_calState[i] = CAL_FAILED;
+                        qDebug("Finger[%d]: calibration failed", i);
+                    }
+                }
+            }
+        }
+
+        if ((m_calState[i] == CAL_SEEK_LOW) || (m_calState[i] == CAL_SWEEP))
+        {
+            finished = false;
+        }
+    }
+
+    if (changed)
+    {
+        ApplyFingerDrive(drive);
+    }
+
+    if (finished)
+    {
+        bool ok = true;
+
+        for (int i = 0; i < NUM_FINGERS; i++)
+        {
+            ok = ok && (m_calState[i] == CAL_DONE);
+        }
+
+        EndCalibration(ok);
+    }
+}
+
+void HandControlThread::EndCalibration(bool iOk)
+{
+    m_calibrating = false;
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        if (m_calState[i] != CAL_DONE)
+        {
+            m_calState[i] = CAL_FAILED;
+        }
+    }
+
+    qDebug("HandControlThread: calibration %s", iOk ? "done" : "failed");
+
+    emit calibrationFinished(iOk);
+}
+
+void HandControlThread::BeginSequence()
+{
+    qDebug("HandControlThread: sequence started, %d steps", m_sequence->count());
+
+    for (int i = 0; i < m_sequence->count(); i++)
+    {
+        m_seqRepeatsLeft[i] = m_sequence->step(i).count;
+    }
+
+    m_sequenceRunning = true;
+    m_seqLastStep = -1;
+    m_seqLastStepMs = 0;
+    m_seqStep = -1;
+
+    NextSequenceStep(0);
+}
+
+/// runs the current step, then any following steps that take no time, so the
+/// steps of one tick all see the same position samples
+void HandControlThread::AdvanceSequence()
+{
+    // bounded, so a loop of steps that take no time cannot hold up the tick
+    for (int n = 0; (n < SEQ_MAX_STEPS) && m_sequenceRunning; n++)
+    {
+        int next;
+
+        if (!RunSequenceStep(m_sequence->step(m_seqStep), &next))
+        {
+            return;
+        }
+
+        NextSequenceStep(next);
+    }
+}
+
+/// one tick of iStep, returns true when it is done with the step to go to next
+/// in oNextStep
+bool HandControlThread::RunSequenceStep(const SequenceStep& iStep, int* oNextStep)
+{
+    quint16 position[NUM_FINGERS];
+    qint16 drive[NUM_FINGERS];
+    bool first = !m_seqStepStarted;
+    bool done = true;
+
+    m_seqStepStarted = true;
+    m_seqStepTicks++;
+    *oNextStep = m_seqStep + 1;
+
+    dataMutex.lock();
+    controlMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        position[i] = currPositionSample[i];
+        drive[i] = SignedDrive(fingerDirs[i], fingerPwmLevel[i]);
+    }
+    controlMutex.unlock();
+    dataMutex.unlock();
+
+    switch (iStep.op)
+    {
+        case (SEQ_DRIVE):
+            for (int i = 0; i < NUM_FINGERS; i++)
+            {
+                drive[i] = iStep.level[i];
+            }
+            ApplyFingerDrive(drive);
+            break;
+
+        case (SEQ_MOVE):
+        {
+            FingerDir downDir = (m_positionIncreasingDir == FINGER_DIR_OPEN) ? FINGER_DIR_CLOSE : FINGER_DIR_OPEN;
+            bool changed = false;
+
+            for (int i = 0; i < NUM_FINGERS; i++)
+            {
+                if ((iStep.finger >= 0) && (iStep.finger != i))
+                {
+                    continue;
+                }
+
+                if (first)
+                {
+                    m_seqMoveUp[i] = (position[i] < iStep.position);
+                    drive[i] = SignedDrive(m_seqMoveUp[i] ? m_positionIncreasingDir : downDir, iStep.level[i]);
+                    changed = true;
+                }
+
+                bool reached = m_seqMoveUp[i] ? (position[i] >= iStep.position) : (position[i] <= iStep.position);
+
+                if (reached && (drive[i] != 0))
+                {
+                    drive[i] = 0;
+                    changed = true;
+                }
+
+                // a finger cut by a stall or end-stop will not get there
+                if (drive[i] != 0)
+                {
+                    done = false;
+                }
+            }
+
+            if (changed)
+            {
+                ApplyFingerDrive(drive);
+            }
+            break;
+        }
+
+        case (SEQ_DWELL):
+            // counted in ticks rather than clock time, so a replay runs it the same
+            if (first)
+            {
+                m_seqDwellTicks = (iStep.ms + TICK_MS - 1) / TICK_MS;
+            }
+            done = (m_seqStepTicks > m_seqDwellTicks);
+            break;
+
+        case (SEQ_WAIT_STOPPED):
+            for (int i = 0; i < NUM_FINGERS; i++)
+            {
+                if (drive[i] != 0)
+                {
+                    done = false;
+                }
+            }
+            break;
+
+        case (SEQ_WAIT_ABOVE):
+        case (SEQ_WAIT_BELOW):
+            for (int i = 0; i < NUM_FINGERS; i++)
+            {
+                if ((iStep.finger >= 0) && (iStep.finger != i))
+                {
+                    continue;
+                }
+
+                if ((iStep.op == SEQ_WAIT_ABOVE) ? (position[i] < iStep.position) : (position[i] > iStep.position))
+                {
+                    done = false;
+                }
+            }
+            break;
+
+        case (SEQ_REPEAT):
+            if (iStep.count == 0)
+            {
+                *oNextStep = iStep.jump;
+            }
+            else if (m_seqRepeatsLeft[m_seqStep] > 0)
+            {
+                m_seqRepeatsLeft[m_seqStep]--;
+                *oNextStep = iStep.jump;
+            }
+            else
+            {
+                // ready for the next time round an outer loop
+                m_seqRepeatsLeft[m_seqStep] = iStep.count;
+            }
+            break;
+    }
+
+    return done;
+}
+
+/// times how long a finger is driven without a command or keepalive, and starts
+/// the ramp down on the first tick past the heartbeat window; timed on the clock
+/// so late ticks do not stretch it, and a replay trips where the trace says
+void HandControlThread::CheckHeartbeat()
+{
+    if (m_heartbeatWindowMs == 0)
+    {
+        return;
+    }
+
+    if (m_deadmanRamping)
+    {
+        RampDownDrive();
+        return;
+    }
+
+    bool driven = false;
+
+    controlMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        if (fingerPwmLevel[i] != 0)
+        {
+            driven = true;
+        }
+    }
+    controlMutex.unlock();
+
+    // the control thread's own sequences and sweeps do not need a caller
+    if (!driven || m_sequenceRunning || m_calibrating)
+    {
+        m_windowStartUs = -1;
+        return;
+    }
+
+    if (m_windowStartUs < 0)
+    {
+        m_windowStartUs = m_clock->nowUs();
+    }
+
+    bool expired;
+
+    if (m_replay)
+    {
+        expired = m_replay->deadmanForTick(m_tick);
+    }
+    else
+    {
+        expired = (m_clock->nowUs() - m_windowStartUs) > (m_heartbeatWindowMs * 1000LL);
+    }
+
+    if (!expired)
+    {
+        return;
+    }
+
+    if (m_recorder)
+    {
+        m_recorder->recordDeadman(m_tick);
+    }
+
+    controlMutex.lock();
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        m_rampStart[i] = fingerPwmLevel[i];
+    }
+    controlMutex.unlock();
+
+    m_deadmanRamping = true;
+    m_rampStep = 0;
+
+    qDebug("HandControlThread: no heartbeat for %d ms, ramping the drive down", m_heartbeatWindowMs);
+
+    emit heartbeatLost();
+
+    RampDownDrive();
+}
+
+/// one step of the ramp down, keeping each finger's direction
+void HandControlThread::RampDownDrive()
+{
+    int steps = (m_heartbeatRampTicks > 0) ? m_heartbeatRampTicks : 1;
+
+    m_rampStep++;
+
+    dataMutex.lock();
+    controlMutex.lock();
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        qint16 level = (m_rampStart[i] * (steps - m_rampStep)) / steps;
+
+        if (pwmState[i] != PWM_NORMAL)
+        {
+            // the output is already off for the direction change, keep it there
+            fingerPwmLevel[i] = 0;
+        }
+        else if ((fingerPwmLevel[i] != 0) && (level < fingerPwmLevel[i]))
+        {
+            // a finger cut by a stall meanwhile stays cut
+            fingerPwmLevel[i] = level;
+            SetPwmForFinger(CompensatedPwm(level), i);
+        }
+    }
+
+    quint32 latencyUs = 0;
+
+    if (m_rampStep >= steps)
+    {
+        qint64 deadlineUs = m_windowStartUs + (m_heartbeatWindowMs * 1000LL);
+
+        m_deadmanRamping = false;
+        m_windowStartUs = -1;
+
+        latencyUs = (m_clock->nowUs() > deadlineUs) ? (m_clock->nowUs() - deadlineUs) : 0;
+
+        m_deadmanStats.trips++;
+        m_deadmanStats.lastLatencyUs = latencyUs;
+        if (latencyUs > m_deadmanStats.maxLatencyUs)
+        {
+            m_deadmanStats.maxLatencyUs = latencyUs;
+        }
+    }
+
     controlMutex.unlock();
     dataMutex.unlock();
+
+    if (m_rampStep >= steps)
+    {
+        qDebug("HandControlThread: drive off %u us after the heartbeat deadline", latencyUs);
+    }
 }
 
-void HandControlThread::run()
-{      
-    // use a loop count as a way of managing periodic tasks (let them run ever so-many loops)
-    int loopCount = 0;
-    
-    while (!m_done)
-    {
-        // make total eventloop time around 10 msec, but split in two for pwm processing
-        // NOTE: if event loop time changes, several of the loop count values below should be 
-        // adjusted accordingly
-		msleep(5);
-        UpdatePwmControlStates();
-        msleep(5);
-        UpdatePwmControlStates();
-        
-        // get finger positions one-third as often (around 33 Hz)
-        if ((loopCount % 3) == 0)
+/// moves on to iStep, or ends the sequence past its last step
+void HandControlThread::NextSequenceStep(int iStep)
+{
+    qint64 nowUs = m_clock->nowUs();
+
+    if (m_seqStep >= 0)
+    {
+        m_seqLastStep = m_seqStep;
+        m_seqLastStepMs = (nowUs - m_seqStepStartUs) / 1000;
+    }
+
+    m_seqStep = iStep;
+    m_seqStepStarted = false;
+    m_seqStepTicks = 0;
+    m_seqStepStartUs = nowUs;
+    m_stateDirty = true;
+
+    if (m_seqStep >= m_sequence->count())
+    {
+        EndSequence(true);
+    }
+}
+
+void HandControlThread::EndSequence(bool iOk)
+{
+    m_sequenceRunning = false;
+    m_stateDirty = true;
+
+    // a cancelled sequence leaves the drive to whatever cancelled it
+    if (iOk)
+    {
+        qint16 drive[NUM_FINGERS];
+
+        for (int i = 0; i < NUM_FINGERS; i++)
         {
-			ReadFingerPositions();
+            drive[i] = 0;
         }
-        
-        // get battery level around once/second
-        if ((loopCount % 99) == 0)
+
+        ApplyFingerDrive(drive);
+    }
+
+    qDebug("HandControlThread: sequence %s", iOk ? "done" : "cancelled");
+
+    emit sequenceFinished(iOk);
+}
+
+/// cuts the drive to any finger that has stalled or reached an end-stop, so the
+/// drive is off before the next position sample
+void HandControlThread::CheckFingerLimits(quint16* iSamples)
+{
+    bool stalled[NUM_FINGERS];
+    bool endStop[NUM_FINGERS];
+    bool anyCut = false;
+
+    dataMutex.lock();
+    controlMutex.lock();
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        stalled[i] = false;
+        endStop[i] = false;
+
+        // only a finger that is actually being driven can stall
+        if ((fingerPwmLevel[i] == 0) || (pwmState[i] != PWM_NORMAL))
         {
-			ReadBatteryLevel();
+            m_stallRefPosition[i] = iSamples[i];
+            m_stallCount[i] = 0;
+            continue;
         }
-        
-        // reset the loop count when it would be 99 the next round
-        loopCount++;
-        if (loopCount >= 99)
+
+        if (!m_endStopsEnabled)
+        {
+            endStop[i] = false;
+        }
+        else if (fingerDirs[i] == m_positionIncreasingDir)
+        {
+            endStop[i] = (iSamples[i] >= m_endStopMax);
+        }
+        else
+        {
+            endStop[i] = (iSamples[i] <= m_endStopMin);
+        }
+
+        if (abs(iSamples[i] - m_stallRefPosition[i]) >= m_stallMinProgress)
+        {
+            m_stallRefPosition[i] = iSamples[i];
+            m_stallCount[i] = 0;
+        }
+        else if (m_stallSamples > 0)
+        {
+            m_stallCount[i]++;
+            stalled[i] = (m_stallCount[i] >= m_stallSamples);
+        }
+
+        if (endStop[i] || stalled[i])
+        {
+            // leaving the direction as is, so a new command the same way is a change
+            fingerPwmLevel[i] = 0;
+            SetPwmForFinger(0, i);
+            m_stallCount[i] = 0;
+            anyCut = true;
+
+            if (endStop[i])
+            {
+                stalled[i] = false;
+                m_limitStats.endStops++;
+            }
+            else
+            {
+                m_limitStats.stalls++;
+            }
+        }
+    }
+
+    if (anyCut)
+    {
+        quint32 reactionUs = m_sampleTimer.nsecsElapsed() / 1000;
+
+        m_limitStats.lastReactionUs = reactionUs;
+        if (reactionUs > m_limitStats.maxReactionUs)
+        {
+            m_limitStats.maxReactionUs = reactionUs;
+        }
+    }
+
+    controlMutex.unlock();
+    dataMutex.unlock();
+
+    for (int i = 0; i < NUM_FINGERS; i++)
+    {
+        if (stalled[i])
+        {
+            qDebug("Finger[%d]: stalled at %d", i, iSamples[i]);
+            emit fingerStalled(i);
+        }
+        else if (endStop[i])
         {
-            loopCount = 0;
+            qDebug("Finger[%d]: end-stop at %d", i, iSamples[i]);
+            emit fingerEndStop(i);
         }
-    }    
+    }
 }
 
-void HandControlThread::ReadFingerPositions()
+/// reads ADCIN2 & 7, returns false if there is no sample
+bool HandControlThread::ReadAdcFingerPositions(quint16* oSamples)
 {
-	quint16 samples[2];
+    bool ok = false;
 
 #ifdef Q_WS_QWS
     char buff[25];
 
-    int fd = open(ADC_FINGER_POS_DEVICE, O_RDONLY);
+    int fd = open(m_devices.fingerPositionAdc.constData(), O_RDONLY);
 
     if (fd < 0)
     {
-        qDebug("HandControlThread::run: Could not open %s", ADC_FINGER_POS_DEVICE);
-        return;
+        qDebug("HandControlThread::run: Could not open %s", m_devices.fingerPositionAdc.constData());
+        return false;
     }
 
     memset(buff, 0, sizeof(buff));
@@ -409,49 +2310,183 @@ void HandControlThread::ReadFingerPositions()
     }
     else
     {
-        sscanf(buff, "%hd %hd", &samples[0], &samples[1]);
-        SetFingerPos(samples);
+        sscanf(buff, "%hd %hd", &oSamples[0], &oSamples[1]);
+        ok = true;
     }
 
     close(fd);
 #else
-	for (int i = 0; i < 2; i++) {
-		if (fingerPwmLevel[i] == 0) {
-			samples[i] = currPositionSample[i];
-		}
-		else {
-			if (fingerDirs[i] == FINGER_DIR_OPEN) {
-				if (currPositionSample[i] <= 0)
-					samples[i] = 0;
-				else
-					samples[i] = currPositionSample[i] - 1;
-			}
-			else {
-				if (currPositionSample[i] >= 100)
-					samples[i] = 100;
-				else
-					samples[i] = currPositionSample[i] + 1;
+    Q_UNUSED(oSamples);
+#endif
+
+    return ok;
+}
+
+/// desktop stand-in for the position sensors, between 0 (closed) and 100 (open) as
+/// GetFingerPos has it; on a full battery a driven finger moves one unit per sample
+/// at any drive level, and slows with the voltage the motor actually sees (the PWM
+/// written against the level asked for, times the battery level)
+void HandControlThread::SimulateFingerPositions(quint16* oSamples)
+{
+	for (int i = 0; i < NUM_FINGERS; i++) {
+		if (fingerPwmLevel[i] != 0) {
+			m_simTravel[i] += (m_pwmOutput[i] * batteryLevel * 1000) / (fingerPwmLevel[i] * SIM_BATTERY_FULL);
+
+			for (; m_simTravel[i] >= 1000; m_simTravel[i] -= 1000) {
+				if (fingerDirs[i] == FINGER_DIR_OPEN) {
+					if (m_simPosition[i] < 100)
+						m_simPosition[i]++;
+				}
+				else {
+					if (m_simPosition[i] > 0)
+						m_simPosition[i]--;
+				}
 			}
 		}
-	}
 
-	SetFingerPos(samples);
-#endif
+		// the simulated sensor covers 0 - 100 but is not linear, so a
+		// calibration has something to correct
+		oSamples[i] = (m_simPosition[i] * (300 - m_simPosition[i])) / 200;
+	}
 }
 
 void HandControlThread::ReadBatteryLevel()
 {
 	quint16 sample;
 
+    if (m_replay)
+    {
+        if (!m_replay->batteryForTick(m_tick, &sample))
+            return;
+    }
+    else if (m_simulated)
+    {
+        SimulateBatteryLevel(&sample);
+    }
+    else if (!ReadAdcBatteryLevel(&sample))
+    {
+        return;
+    }
+
+    if (m_recorder)
+    {
+        m_recorder->recordBattery(m_tick, sample);
+    }
+
+    SetBatteryLevel(sample);
+    UpdateBatteryCompensation(sample);
+}
+
+/// filters the battery level and rescales the PWM of any running finger when the
+/// scale it gives changes
+void HandControlThread::UpdateBatteryCompensation(quint16 iSample)
+{
+    if (m_battMaxGain == 0)
+    {
+        return;
+    }
+
+    if (m_battFiltered < 0)
+    {
+        m_battFiltered = iSample << 4;
+    }
+    else
+    {
+        m_battFiltered += ((iSample << 4) - m_battFiltered) >> BATT_FILTER_SHIFT;
+    }
+
+    int gain;
+
+    if (m_battCurvePoints > 0)
+    {
+        int last = m_battCurvePoints - 1;
+
+        if (m_battFiltered <= (m_battCurveLevel[0] << 4))
+        {
+            gain = m_battCurveGain[0] * 10;
+        }
+        else if (m_battFiltered >= (m_battCurveLevel[last] << 4))
+        {
+            gain = m_battCurveGain[last] * 10;
+        }
+        else
+        {
+            int k = 0;
+            while (m_battFiltered >= (m_battCurveLevel[k + 1] << 4))
+            {
+                k++;
+            }
+
+            int span = (m_battCurveLevel[k + 1] - m_battCurveLevel[k]) << 4;
+            int into = m_battFiltered - (m_battCurveLevel[k] << 4);
+
+            gain = (m_battCurveGain[k] * 10) + ((m_battCurveGain[k + 1] - m_battCurveGain[k]) * 10 * into) / span;
+        }
+    }
+    else if (m_battFiltered > 0)
+    {
+        gain = (m_battNominal * 16 * BATT_UNITY_GAIN) / m_battFiltered;
+    }
+    else
+    {
+        gain = m_battMaxGain;
+    }
+
+    if (gain > m_battMaxGain)
+    {
+        gain = m_battMaxGain;
+    }
+
+    if (gain < BATT_MIN_GAIN)
+    {
+        gain = BATT_MIN_GAIN;
+    }
+
+    dataMutex.lock();
+    controlMutex.lock();
+
+    if (gain != m_driveGain)
+    {
+        m_driveGain = gain;
+
+        // a finger mid direction change picks the new scale up when its drive goes back on
+        for (int i = 0; i < NUM_FINGERS; i++)
+        {
+            if ((pwmState[i] == PWM_NORMAL) && (fingerPwmLevel[i] != 0)
+                && (CompensatedPwm(fingerPwmLevel[i]) != m_pwmOutput[i]))
+            {
+                SetPwmForFinger(CompensatedPwm(fingerPwmLevel[i]), i);
+            }
+        }
+    }
+
+    controlMutex.unlock();
+    dataMutex.unlock();
+}
+
+/// the PWM value for drive level iLevel with the battery compensation applied
+/// call with controlMutex held
+int HandControlThread::CompensatedPwm(int iLevel)
+{
+    int pwm = ((iLevel * m_driveGain) + (BATT_UNITY_GAIN / 2)) / BATT_UNITY_GAIN;
+
+    return (pwm > PWM_MAX) ? PWM_MAX : pwm;
+}
+
+/// reads ADCIN3, returns false if there is no sample
+bool HandControlThread::ReadAdcBatteryLevel(quint16* oSample)
+{
+    bool ok = false;
+
 #ifdef Q_WS_QWS
     char buff[10];
 
-    int fd = open(ADC_BATTERY_DEVICE, O_RDONLY);
+    int fd = open(m_devices.batteryAdc.constData(), O_RDONLY);
 
     if (fd < 0)
     {
-        qDebug("HandControlThread::run: Could not open %s", ADC_BATTERY_DEVICE);
-        return;
+        qDebug("HandControlThread::run: Could not open %s", m_devices.batteryAdc.constData());
+        return false;
     }
 
     memset(buff, 0, sizeof(buff));
@@ -462,17 +2497,26 @@ void HandControlThread::ReadBatteryLevel()
     }
     else
     {
-        sscanf(buff, "%hd", &sample);
-        SetBatteryLevel(sample);
+        sscanf(buff, "%hd", oSample);
+        ok = true;
     }
 
     close(fd);
 #else
+    Q_UNUSED(oSample);
+#endif
+
+    return ok;
+}
+
+/// desktop stand-in for the battery, sagging one unit per sample from full
+/// down to SIM_BATTERY_EMPTY
+void HandControlThread::SimulateBatteryLevel(quint16* oSample)
+{
 	if (batteryLevel == 0)
-		sample = 100;
+		*oSample = SIM_BATTERY_FULL;
+	else if (batteryLevel > SIM_BATTERY_EMPTY)
+		*oSample = batteryLevel - 1;
 	else
-		sample = batteryLevel - 1;
-
-	SetBatteryLevel(sample);
-#endif
+		*oSample = batteryLevel;
 }
@@ -12,6 +12,10 @@
 
 #include <QThread>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QString>
+#include <QByteArray>
 
 /// number of fingers that can be independently driven and read
 const int NUM_FINGERS = 2;
@@ -24,6 +28,112 @@ enum FingerDir
     FINGER_DIR_CLOSE
 };
 
+/// One timestamped finger position sample, see HandControlThread::fetchSince()
+struct FingerSample
+{
+    quint32 seq;                    ///< sequence number, increments by one per sample
+    qint64 timestampUs;             ///< monotonic time the sample was taken
+    quint16 position[NUM_FINGERS];  ///< finger positions, as GetFingerPos
+    qint16 drive[NUM_FINGERS];      ///< drive level in effect, as SetFingerDrive
+};
+
+/// most position samples a calibration sweep may take (around a minute)
+const int CAL_MAX_SAMPLES = 2048;
+
+/// most points in a battery compensation curve, see SetBatteryCurve()
+const int BATT_MAX_CURVE_POINTS = 8;
+
+/// most steps in a sequence, see MotionSequence
+const int SEQ_MAX_STEPS = 64;
+
+/// Snapshot of the hand state, see HandControlThread::TakeState()
+struct HandState
+{
+    quint32 sampleSeq;              ///< seq of the newest finger sample, see fetchSince
+    qint64 timestampUs;             ///< monotonic time of the newest finger sample
+    quint16 position[NUM_FINGERS];  ///< finger positions, as GetFingerPos
+    quint16 positionMax;            ///< top of their range, 100 once calibrated, else the ADC full scale
+    qint16 drive[NUM_FINGERS];      ///< drive level in effect, as SetFingerDrive
+    quint16 batteryLevel;           ///< as GetBatteryLevel
+    quint16 driveGain;              ///< battery compensation applied to the PWM, percent
+    qint16 sequenceStep;            ///< step the running sequence is on, -1 when none is
+    qint16 sequenceLastStep;        ///< last sequence step to finish, -1 for none
+    quint32 sequenceLastStepMs;     ///< how long it took
+};
+
+/// Counters for the GUI update path, see GetUpdateStats()
+struct UpdateStats
+{
+    quint32 samplesProduced;        ///< position and battery samples taken
+    quint32 statesPublished;        ///< snapshots made available to TakeState
+};
+
+/// Control loop timing statistics, see GetLoopStats()
+struct LoopStats
+{
+    quint32 ticks;                  ///< active ticks measured
+    quint32 maxLateUs;              ///< worst wakeup lateness over the tick period
+    quint64 totalLateUs;            ///< sum of wakeup lateness, for the average
+};
+
+/// PWM write counts, see GetPwmStats()
+struct PwmStats
+{
+    quint32 requested;              ///< PWM values the control loop set
+    quint32 written;                ///< device writes they took, after skipping the unchanged
+};
+
+/// Stall and end-stop statistics, see GetLimitStats()
+struct LimitStats
+{
+    quint32 stalls;                 ///< drives cut because a finger stopped moving
+    quint32 endStops;               ///< drives cut at a soft end-stop
+    quint32 lastReactionUs;         ///< start of the position read to PWM zero, last cut
+    quint32 maxReactionUs;          ///< start of the position read to PWM zero, worst case
+};
+
+/// Heartbeat deadman statistics, see GetDeadmanStats()
+struct DeadmanStats
+{
+    quint32 trips;                  ///< drives ramped down for want of a heartbeat
+    quint32 lastLatencyUs;          ///< missed deadline to PWM zero, last trip
+    quint32 maxLatencyUs;           ///< missed deadline to PWM zero, worst case
+};
+
+class SampleHistory;
+class PwmOutput;
+class HandClock;
+class HandTrace;
+struct TraceSettings;
+class PositionCalibration;
+class HandRig;
+class MotionSequence;
+struct SequenceStep;
+
+/// Device files for one hand, so several boards can be driven from one process
+/// (see HandRig); the defaults are the SOM's own devices
+struct HandDevices
+{
+    HandDevices();
+
+    QByteArray pwm[NUM_FINGERS];    ///< PWM output for each finger, a /dev/pwm<n> device
+                                    ///< or a /sys/class/pwm/pwmchip<n>/pwm<m> channel
+    int pwmFrequencyHz;             ///< for sysfs channels, 5 - 10 kHz
+    QByteArray gpio[NUM_FINGERS];   ///< direction GPIO value for each finger
+    QByteArray fingerPositionAdc;   ///< both position sensors, "<finger 1> <finger 2>"
+    QByteArray batteryAdc;          ///< battery voltage
+};
+
+/// Statistics for the idle (tickless) mode of the control loop
+struct IdleStats
+{
+    quint32 idleWakeups;            ///< number of times the loop woke while idle
+    quint32 idleTimeMs;             ///< total time spent idle
+    quint32 resumeCount;            ///< number of idle -> active transitions
+    quint32 lastResumeLatencyUs;    ///< SetFingerDrive to first active tick, last resume
+    quint32 maxResumeLatencyUs;     ///< SetFingerDrive to first active tick, worst case
+};
+
 /// The HandControlThread class provides control over the hand's 2 motors and feedback 
 /// from the hand's 2 position sensors.
 /// The values handled are:
@@ -41,11 +151,46 @@ public:
     explicit HandControlThread(QObject *parent = 0);
     ~HandControlThread();
     
+	/// starts the control loop, which opens and checks the devices and takes the
+	/// first samples on its own thread, then signals hardwareReady; returns at once
 	bool startThread();
+	/// stops the loop, cancelling a bring-up still under way, and once it has
+	/// finished zeroes and closes the outputs; a hand on a running rig is
+	/// stopped and closed by the rig on its next pass, without waiting for it,
+	/// and stays stopped until the rig is restarted
 	void stopThread();
 
+    /// replaces the time source for the control loop, the thread takes ownership
+    /// call before startThread
+    void SetClock(HandClock* iClock);
+
+    /// runs against the simulated hand instead of the devices (always on for the
+    /// desktop build), call before startThread
+    void SetSimulated(bool iSimulated);
+
+    /// replaces the device files, call before startThread
+    void SetDevices(const HandDevices& iDevices);
+
+    /// makes the thread stop by itself after iRunTimeMs of clock time, 0 to run
+    /// until stopThread
+    void SetRunTime(qint64 iRunTimeMs);
+
+    /// records every command, sensor sample and output to iPath, see HandTrace
+    /// call before startThread
+    bool SetRecordFile(const QString& iPath);
+
+    /// replays the commands and sensor samples in iPath in place of the caller and
+    /// the hand, checking the outputs match; the thread stops at the end of the trace
+    /// call before startThread, along with a VirtualClock to run it flat out; the
+    /// trace is read during bring-up, which fails if it cannot be
+    bool SetReplayFile(const QString& iPath);
+
+    /// outputs that did not match the replayed trace, 0 for a clean replay
+    int ReplayMismatches();
+
     /// set the drive level and implied direction
     /// iDriveLevel should be -100 - 100 where negative implies opening
+    /// the control thread applies the latest command at the start of its next tick
     void SetFingerDrive(qint16 iDriveLevel[NUM_FINGERS]);
     
     /// gets the battery level
@@ -56,13 +201,131 @@ public:
     /// oFingerPos is a pointer to a NUM_FINGER long array to write to
     /// each value is 0 - 100 where 100 is fully extended and 0 is fully closed
     void GetFingerPos(quint16* oFingerPos);
-    
+
+    /// copies up to iMax finger samples newer than iSinceSeq into oSamples, oldest first
+    /// returns the number copied; pass the seq of the last one as iSinceSeq next time
+    /// safe to call from any number of threads, the control thread never waits on readers
+    int fetchSince(quint32 iSinceSeq, FingerSample* oSamples, int iMax);
+
+    /// enables/disables the idle mode, where the control loop drops to a slow
+    /// housekeeping tick while all fingers are stopped (enabled by default)
+    void SetIdleMode(bool iEnable);
+
+    /// gets the idle mode statistics
+    void GetIdleStats(IdleStats* oStats);
+
+    /// copies the latest state snapshot into oState if it has changed since the last
+    /// call, returns false if not; the GUI calls it when StateNotifierFd is readable
+    /// (the control thread does not post to the GUI, a queued signal allocates)
+    bool TakeState(HandState* oState);
+
+    /// read end of a pipe that becomes readable when a snapshot is published, for a
+    /// QSocketNotifier in the GUI; TakeState empties it. -1 where there is no pipe
+    /// (not a unix build), then the GUI has to poll TakeState
+    int StateNotifierFd();
+
+    /// turns on logging of every PWM and GPIO write and direction change step,
+    /// which allocates in the control loop
+    void SetVerbose(bool iVerbose);
+
+    /// heap allocations the control loop made after warming up, only counted in
+    /// a CONFIG+=alloccheck build (see AllocationCheck), 0 otherwise
+    int LoopAllocations();
+
+    /// gets the GUI update path counters
+    void GetUpdateStats(UpdateStats* oStats);
+
+    /// cuts a finger's drive when it moves less than iMinProgress over iSamples
+    /// consecutive position samples while driven; iSamples = 0 disables
+    void SetStallDetection(int iSamples, int iMinProgress);
+
+    /// cuts a finger's drive when it reaches iMin or iMax while driven towards it
+    /// end-stops are off until this is called
+    void SetEndStops(quint16 iMin, quint16 iMax);
+
+    /// sets which way a finger is driven to make its position reading increase,
+    /// which the end-stops, calibration sweep and sequence moves depend on; the
+    /// default is opening, as GetFingerPos has it, call before startThread
+    void SetPositionDirection(FingerDir iIncreasingDir);
+
+    /// gets the stall and end-stop statistics
+    void GetLimitStats(LimitStats* oStats);
+
+    /// raw to position tables to load during bring-up, and where a new
+    /// calibration is saved; without a table positions are the raw ADC samples
+    /// call before startThread
+    void SetCalibrationFile(const QString& iPath);
+
+    /// drives each finger slowly to its low end, then across to its high end,
+    /// and rebuilds its position table from the sweep; any drive command cancels
+    void StartCalibration();
+
+    /// saves the position tables to the calibration file, called from the
+    /// calibrationFinished slot so the control thread does no file I/O; the
+    /// tables only change during a sweep
+    bool SaveCalibration();
+
+    /// scales every PWM output by iNominal / the filtered battery level, so a finger
+    /// keeps its speed as the battery sags; the scale is held to at most iMaxGain
+    /// percent, 0 for off (the default), call before startThread
+    /// the battery level is in GetBatteryLevel's units
+    void SetBatteryCompensation(quint16 iNominal, int iMaxGain);
+
+    /// replaces the iNominal / level curve with a measured one, iPoints points of
+    /// battery level (ascending) and PWM scale in percent, interpolated between
+    /// points and held at the ends; call after SetBatteryCompensation
+    bool SetBatteryCurve(const quint16* iLevels, const quint16* iGain, int iPoints);
+
+    /// arms the heartbeat deadman: once a finger has been driven for iWindowMs
+    /// without a SetFingerDrive or KeepAlive, the control thread ramps the drive
+    /// to zero over iRampMs by itself. The window is timed on the clock and the
+    /// ramp takes iRampMs / 5 ms ticks, so the drive is off within iWindowMs +
+    /// iRampMs plus a tick, stretched only by ticks running late during the ramp.
+    /// 0 for off (the default)
+    /// sequences and calibration sweeps run without a heartbeat
+    void SetHeartbeat(int iWindowMs, int iRampMs);
+
+    /// tells the deadman the caller is still alive without changing the drive
+    void KeepAlive();
+
+    /// gets the PWM write counts
+    void GetPwmStats(PwmStats* oStats);
+
+    /// gets the heartbeat deadman statistics
+    void GetDeadmanStats(DeadmanStats* oStats);
+
+    /// runs iSequence on the control thread from its next tick, see MotionSequence
+    /// any drive command or calibration cancels it; when replaying, this only
+    /// loads the sequence the trace starts
+    void RunSequence(const MotionSequence& iSequence);
+
+    /// gets/clears the control loop jitter statistics
+    void GetLoopStats(LoopStats* oStats);
+    void ResetLoopStats();
     
 signals:
-    void fingerPositionUpdated();
-    void batteryLevelUpdated();
+    /// the devices are open and the first samples taken (iOk true), or bring-up
+    /// failed and the control loop has stopped
+    void hardwareReady(bool iOk);
+
+    /// the control thread cut iFinger's drive because it stopped moving
+    void fingerStalled(int iFinger);
+
+    /// the control thread cut iFinger's drive at a soft end-stop
+    void fingerEndStop(int iFinger);
+
+    /// a calibration sweep has finished and its tables are in use (not yet saved,
+    /// see SaveCalibration), iOk is false if it failed or was cancelled
+    void calibrationFinished(bool iOk);
+
+    /// a sequence has run to the end, or was cancelled (iOk false)
+    void sequenceFinished(bool iOk);
+
+    /// the heartbeat was missed and the control thread is ramping the drive down
+    void heartbeatLost();
     
 protected:
+    friend class HandRig;
 	
     void run();
     void SetFingerPos(quint16* iFingerPos);
@@ -76,17 +339,275 @@ protected:
 //    void GetFingerDriveLevel(int16_t* oDriveLevel);
 //    void GetFingerDir(FingerDir* oFingerDir);
     void UpdatePwmControlStates();
+    void ApplyPendingCommand();
+    void ApplyFingerDrive(qint16* iDriveLevel);
+    void RunControlTick();
+
+    /// the control loop as a series of steps, so a HandRig can interleave many
+    /// hands on one thread; run() is the single hand version
+    bool BringUp();
+    bool BringUpCancelled();
+
+    /// the settings a trace records, and putting them back for its replay
+    void GetTraceSettings(TraceSettings* oSettings);
+    bool ApplyTraceSettings(const TraceSettings& iSettings);
+    void PrepareRun();
+    bool RunFinished();
+    bool IsServiceDue(qint64 iNowUs);
+    qint64 ServiceDueUs();
+    void WaitForService();
+    void ScheduleLoop(qint64 iNowUs);
+    void Service();
+    void FinishRun();
+    void TraceOutput(char iType, int iFingerNum, int iValue);
     
 	void ReadFingerPositions();
+	void CheckFingerLimits(quint16* iSamples);
+	void BeginCalibration();
+	void RunCalibration(quint16* iRawSamples);
+	void EndCalibration(bool iOk);
+	void BeginSequence();
+	void AdvanceSequence();
+	bool RunSequenceStep(const SequenceStep& iStep, int* oNextStep);
+	void NextSequenceStep(int iStep);
+	void EndSequence(bool iOk);
+	void CheckHeartbeat();
+	void RampDownDrive();
 	void ReadBatteryLevel();
+	void UpdateBatteryCompensation(quint16 iSample);
+	int CompensatedPwm(int iLevel);
+	bool ReadAdcFingerPositions(quint16* oSamples);
+	bool ReadAdcBatteryLevel(quint16* oSample);
+	void SimulateFingerPositions(quint16* oSamples);
+	void SimulateBatteryLevel(quint16* oSample);
+
+    void PublishState();
+
+    bool IsIdle();
+    void WakeControlLoop();
+
+    /// true while this hand's control loop is running, on its own thread or a rig's
+    bool IsControlLoopRunning();
+
+    /// the thread the control loop runs on
+    QThread* ControlThread();
 	
 private:
 	void closeFiles();
 
 	bool m_done;
 
-    /// file descriptors for each PWM output
-    int pwmFileDescriptors[NUM_FINGERS];
+    /// time source for every sleep, timeout and timestamp in the control loop
+    /// (the rig's when in a rig)
+    HandClock *m_clock;
+
+    /// rig serving this hand, or NULL when it runs on its own thread
+    HandRig *m_rig;
+
+    /// device files
+    HandDevices m_devices;
+
+    /// using the simulated hand rather than the devices
+    bool m_simulated;
+
+    /// clock time to run for, 0 for no limit
+    qint64 m_runTimeUs;
+
+    /// control loop tick count, control thread only
+    quint32 m_tick;
+
+    /// where the control loop is and when it next needs to run, see Service()
+    /// control thread only
+    bool m_idling;
+    bool m_secondTick;
+    int m_loopCount;
+    int m_idleTickCount;
+    qint64 m_serviceDueUs;
+    qint64 m_idleStartUs;
+
+    /// clock and wall time at the start of the run, for the speed report
+    qint64 m_startUs;
+    QElapsedTimer m_wallTimer;
+
+    /// started by startThread, for the bring-up and first sample times
+    QElapsedTimer m_bringUpTimer;
+    bool m_firstSampleTaken;
+
+    /// trace being recorded, or NULL
+    HandTrace *m_recorder;
+
+    /// trace being replayed, or NULL; read from m_replayFile by BringUp
+    HandTrace *m_replay;
+    QString m_replayFile;
+
+    /// protects the command mailbox
+    QMutex commandMutex;
+
+    /// latest command from SetFingerDrive, not yet applied by the control loop
+    qint16 m_pendingDrive[NUM_FINGERS];
+    bool m_commandPending;
+
+    /// stall detection settings, 0 samples for off
+    int m_stallSamples;
+    int m_stallMinProgress;
+
+    /// direction that makes the position reading increase, see SetPositionDirection
+    FingerDir m_positionIncreasingDir;
+
+    /// soft end-stops
+    bool m_endStopsEnabled;
+    quint16 m_endStopMin;
+    quint16 m_endStopMax;
+
+    /// per finger stall detection, control thread only
+    quint16 m_stallRefPosition[NUM_FINGERS];
+    int m_stallCount[NUM_FINGERS];
+
+    /// started at the beginning of each position read, for the reaction time
+    QElapsedTimer m_sampleTimer;
+
+    /// stall and end-stop statistics, protected by dataMutex
+    LimitStats m_limitStats;
+
+    /// raw sample to position tables, only changed by the control thread once running
+    PositionCalibration *m_calibration;
+    QString m_calibrationFile;
+
+    /// set by StartCalibration, picked up with the next command and cancelled by
+    /// a SetFingerDrive or RunSequence before then (commandMutex)
+    bool m_calibrationRequested;
+
+    /// State of each finger's calibration sweep
+    enum CalState
+    {
+        CAL_SEEK_LOW,               ///< driving to the low end
+        CAL_SWEEP,                  ///< driving to the high end, recording samples
+        CAL_DONE,
+        CAL_FAILED
+    };
+
+    /// calibration sweep, control thread only
+    bool m_calibrating;
+    CalState m_calState[NUM_FINGERS];
+    bool m_calMoving[NUM_FINGERS];
+    quint16 m_calRefRaw[NUM_FINGERS];
+    int m_calStallCount[NUM_FINGERS];
+    int m_calLastProgress[NUM_FINGERS];
+    quint16 m_calSamples[NUM_FINGERS][CAL_MAX_SAMPLES];
+    int m_calCount[NUM_FINGERS];
+
+    /// set by RunSequence, with the sequence to run, and cancelled by a
+    /// SetFingerDrive or StartCalibration before it is picked up (commandMutex)
+    bool m_sequenceRequested;
+    MotionSequence *m_pendingSequence;
+
+    /// running sequence, control thread only
+    MotionSequence *m_sequence;
+    bool m_sequenceRunning;
+    int m_seqStep;
+    bool m_seqStepStarted;
+    quint32 m_seqStepTicks;         ///< ticks spent on the current step
+    quint32 m_seqDwellTicks;
+    bool m_seqMoveUp[NUM_FINGERS];  ///< direction of the current move
+    quint16 m_seqRepeatsLeft[SEQ_MAX_STEPS];  ///< for each repeat step
+    qint64 m_seqStepStartUs;
+    int m_seqLastStep;
+    quint32 m_seqLastStepMs;
+
+    /// heartbeat deadman settings, 0 window for off
+    int m_heartbeatWindowMs;
+    int m_heartbeatRampMs;
+    int m_heartbeatRampTicks;
+
+    /// set by KeepAlive, picked up with the next command (commandMutex)
+    bool m_keepAlivePending;
+
+    /// heartbeat deadman, control thread only
+    qint64 m_windowStartUs;         ///< when a finger was first driven after the last command or
+                                    ///< keepalive, -1 when the window is not running
+    bool m_deadmanRamping;
+    int m_rampStep;
+    qint16 m_rampStart[NUM_FINGERS];
+
+    /// deadman statistics, protected by dataMutex
+    DeadmanStats m_deadmanStats;
+
+    /// battery compensation settings, 0 max gain for off
+    quint16 m_battNominal;
+    int m_battMaxGain;
+    quint16 m_battCurveLevel[BATT_MAX_CURVE_POINTS];
+    quint16 m_battCurveGain[BATT_MAX_CURVE_POINTS];
+    int m_battCurvePoints;
+
+    /// filtered battery level in 1/16ths, -1 before the first sample, control thread only
+    int m_battFiltered;
+
+    /// scale applied to the PWM outputs (1/1000ths), protected by controlMutex
+    int m_driveGain;
+
+    /// last value written to each PWM output, protected by controlMutex
+    int m_pwmOutput[NUM_FINGERS];
+
+    /// latest raw position samples, control thread only
+    quint16 m_lastRawSample[NUM_FINGERS];
+
+    /// simulated finger positions, and travel towards the next unit (1/1000ths),
+    /// control thread only
+    int m_simPosition[NUM_FINGERS];
+    int m_simTravel[NUM_FINGERS];
+
+    /// log every output write, see SetVerbose
+    bool m_verbose;
+
+    /// idle mode enabled
+    bool m_idleMode;
+
+    /// protects the idle wakeup request
+    QMutex idleMutex;
+
+    /// signalled by SetFingerDrive/stopThread to wake an idle control loop
+    QWaitCondition idleCondition;
+
+    /// set when the control loop has been asked to leave idle
+    bool m_wakeRequested;
+
+    /// started when the last wakeup was requested, used for resume latency
+    QElapsedTimer m_wakeTimer;
+
+    /// idle statistics, protected by dataMutex
+    IdleStats m_idleStats;
+
+    /// recent finger samples for fetchSince
+    SampleHistory *m_history;
+
+    /// set when a sample has been taken since the last snapshot, control thread only
+    bool m_stateDirty;
+
+    /// latest snapshot for TakeState, and whether it has been taken, protected by dataMutex
+    HandState m_state;
+    bool m_stateFresh;
+
+    /// pipe the control thread writes a byte to when a snapshot the GUI has not
+    /// taken is published, -1s when there is none
+    int m_stateFd[2];
+
+    /// timestamp of the newest finger sample, protected by dataMutex
+    qint64 m_lastSampleUs;
+
+    /// clock time of the last snapshot, -1 for none, control thread only
+    qint64 m_lastPublishUs;
+
+    /// GUI update path counters, protected by dataMutex
+    UpdateStats m_updateStats;
+
+    /// control loop jitter, protected by dataMutex
+    LoopStats m_loopStats;
+
+    /// PWM output for each finger, open while the thread is started
+    PwmOutput *m_pwm[NUM_FINGERS];
+
+    /// PWM write counts, protected by dataMutex
+    PwmStats m_pwmStats;
            
     /// protects the PWM state data
     QMutex controlMutex;
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <QFile>
+#include <QStringList>
+
+#include "handrig.h"
+#include "handclock.h"
+
+HandRig::HandRig(QObject *parent)
+	: QThread(parent)
+{
+	m_clock = new RealTimeClock;
+	m_wakeRequested = false;
+}
+
+HandRig::~HandRig()
+{
+	stopRig();
+
+	// the hands are using the rig's clock
+	for (int i = 0; i < m_hands.size(); i++)
+		delete m_hands[i];
+
+	delete m_clock;
+}
+
+void HandRig::SetClock(HandClock *iClock)
+{
+	if (isRunning() || !m_hands.isEmpty())
+		return;
+
+	delete m_clock;
+	m_clock = iClock;
+}
+
+HandControlThread* HandRig::AddHand()
+{
+	if (isRunning() || m_hands.size() >= RIG_MAX_HANDS)
+		return NULL;
+
+	HandControlThread *hand = new HandControlThread;
+
+	delete hand->m_clock;
+	hand->m_clock = m_clock;
+	hand->m_rig = this;
+
+	m_hands.append(hand);
+
+	return hand;
+}
+
+int HandRig::AddHands(const QString &iPath)
+{
+	QFile file(iPath);
+
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qDebug("HandRig: could not open %s", iPath.toLocal8Bit().constData());
+		return 0;
+	}
+
+	int added = 0;
+	int lineNum = 0;
+
+	while (!file.atEnd()) {
+		QString line = QString(file.readLine()).simplified();
+		lineNum++;
+
+		if (line.isEmpty() || line.startsWith("#"))
+			continue;
+
+		QStringList fields = line.split(' ');
+		HandDevices devices;
+		FingerDir increasingDir = FINGER_DIR_OPEN;
+
+		if (fields.size() == 7 && (fields.at(6) == "open" || fields.at(6) == "close")) {
+			increasingDir = (fields.at(6) == "open") ? FINGER_DIR_OPEN : FINGER_DIR_CLOSE;
+			fields.removeLast();
+		}
+
+		if (fields.size() == 6) {
+			for (int i = 0; i < NUM_FINGERS; i++) {
+				devices.pwm[i] = fields.at(i).toLocal8Bit();
+				devices.gpio[i] = fields.at(NUM_FINGERS + i).toLocal8Bit();
+			}
+
+			devices.fingerPositionAdc = fields.at(4).toLocal8Bit();
+			devices.batteryAdc = fields.at(5).toLocal8Bit();
+		}
+		else if (fields.size() != 1 || fields.at(0) != "sim") {
+			qDebug("HandRig: %s line %d is not a hand", iPath.toLocal8Bit().constData(), lineNum);
+			continue;
+		}
+
+		HandControlThread *hand = AddHand();
+
+		if (!hand)
+			break;
+
+		hand->SetDevices(devices);
+		hand->SetSimulated(fields.size() == 1);
+		hand->SetPositionDirection(increasingDir);
+		added++;
+	}
+
+	return added;
+}
+
+int HandRig::HandCount()
+{
+	return m_hands.size();
+}
+
+HandControlThread* HandRig::Hand(int iIndex)
+{
+	return m_hands.at(iIndex);
+}
+
+bool HandRig::startRig()
+{
+	if (isRunning() || m_hands.isEmpty())
+		return false;
+
+	for (int i = 0; i < m_hands.size(); i++) {
+		if (!m_hands[i]->startThread()) {
+			for (int j = 0; j < i; j++)
+				m_hands[j]->stopThread();
+
+			return false;
+		}
+	}
+
+	m_wakeRequested = false;
+
+	start();
+
+	qDebug("HandRig started with %d hands", m_hands.size());
+
+	return true;
+}
+
+void HandRig::stopRig()
+{
+	int i;
+
+	if (!isRunning())
+		return;
+
+	// each hand's loop finishes its current step and stops
+	for (i = 0; i < m_hands.size(); i++)
+		m_hands[i]->m_done = true;
+
+	WakeRig();
+
+	for (i = 0; i < 10; i++) {
+		wait(100);
+
+		if (!isRunning())
+			break;
+	}
+
+	// the hands' outputs cannot be closed under a running loop
+	if (i == 10) {
+		qDebug("HandRig is slow to stop, waiting for it");
+		wait();
+	}
+
+	for (i = 0; i < m_hands.size(); i++)
+		m_hands[i]->stopThread();
+}
+
+void HandRig::WakeRig()
+{
+	m_wakeMutex.lock();
+	m_wakeRequested = true;
+	m_wakeCondition.wakeOne();
+	m_wakeMutex.unlock();
+}
+
+void HandRig::run()
+{
+	bool running[RIG_MAX_HANDS];
+	int numRunning = m_hands.size();
+
+	// a hand that does not come up is left out
+	for (int i = 0; i < m_hands.size(); i++) {
+		running[i] = m_hands[i]->BringUp();
+
+		if (running[i])
+			m_hands[i]->PrepareRun();
+		else
+			numRunning--;
+	}
+
+	while (numRunning > 0) {
+		qint64 nowUs = m_clock->nowUs();
+		qint64 dueUs = 0;
+		bool serviced = false;
+
+		for (int i = 0; i < m_hands.size(); i++) {
+			HandControlThread *hand = m_hands[i];
+
+			if (!running[i])
+				continue;
+
+			// closed here, so a hand stopped on its own (HandControlThread::stopThread)
+			// does not keep its last drive until the whole rig stops
+			if (hand->RunFinished()) {
+				hand->FinishRun();
+				hand->closeFiles();
+				running[i] = false;
+				numRunning--;
+				continue;
+			}
+
+			if (hand->IsServiceDue(nowUs)) {
+				hand->Service();
+				serviced = true;
+			}
+
+			if (dueUs == 0 || hand->ServiceDueUs() < dueUs)
+				dueUs = hand->ServiceDueUs();
+		}
+
+		// servicing takes time, so look again before sleeping
+		if (serviced || numRunning == 0)
+			continue;
+
+		// wait for the earliest hand, the wait condition only has msec resolution
+		// so the last part is slept
+		qint64 waitUs = dueUs - m_clock->nowUs();
+
+		m_wakeMutex.lock();
+		if (!m_wakeRequested && waitUs >= 1000)
+			m_clock->waitMs(&m_wakeCondition, &m_wakeMutex, waitUs / 1000);
+		m_wakeRequested = false;
+		m_wakeMutex.unlock();
+
+		if (waitUs > 0 && waitUs < 1000)
+			m_clock->sleepUs(waitUs);
+	}
+}
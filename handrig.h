@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef HANDRIG_H
+#define HANDRIG_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include <QString>
+
+#include "handcontrolthread.h"
+
+class HandClock;
+
+/// most hands one rig thread will serve
+const int RIG_MAX_HANDS = 32;
+
+/// Test bench rig: one thread runs the control loops of several hands, each
+/// with its own device files, instead of one thread per hand.
+/// Each hand keeps its own schedule (see HandControlThread::Service) and the
+/// rig sleeps until the earliest one is due, or until a command wakes an idle
+/// hand. The hands are used from the GUI exactly as a single HandControlThread.
+class HandRig : public QThread
+{
+	Q_OBJECT
+
+public:
+	explicit HandRig(QObject *parent = 0);
+	~HandRig();
+
+	/// replaces the time source for every hand, the rig takes ownership
+	/// call before adding hands
+	void SetClock(HandClock *iClock);
+
+	/// adds a hand with the default devices, the rig owns it
+	/// configure it (SetDevices, SetSimulated ...) before startRig
+	HandControlThread* AddHand();
+
+	/// adds a hand per line of iPath, either "sim" for a simulated hand or
+	/// "<pwm 1> <pwm 2> <gpio 1> <gpio 2> <position adc> <battery adc> [open|close]",
+	/// where a pwm is a /dev/pwm<n> device or a /sys/class/pwm/pwmchip<n>/pwm<m>
+	/// channel and the last field is the drive direction that makes the position
+	/// reading go up (see HandControlThread::SetPositionDirection)
+	/// blank lines and lines starting with # are skipped
+	/// returns the number of hands added
+	int AddHands(const QString &iPath);
+
+	int HandCount();
+	HandControlThread* Hand(int iIndex);
+
+	/// starts every hand's control loop on the rig thread
+	bool startRig();
+
+	/// stops every hand's control loop and zeroes the outputs
+	void stopRig();
+
+protected:
+	friend class HandControlThread;
+
+	void run();
+
+	/// called by a hand when a command needs its control loop to wake
+	void WakeRig();
+
+private:
+	HandClock *m_clock;
+	QList<HandControlThread*> m_hands;
+
+	/// protects m_wakeRequested
+	QMutex m_wakeMutex;
+
+	/// signalled by WakeRig
+	QWaitCondition m_wakeCondition;
+
+	/// set when a hand has asked to be woken since the rig last looked
+	bool m_wakeRequested;
+};
+
+#endif // HANDRIG_H
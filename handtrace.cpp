@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <string.h>
+
+#include <QFile>
+
+#include "handtrace.h"
+
+// one bit for each O line, a trace has all of them or none
+enum
+{
+	SETTING_STALL = 0x01,
+	SETTING_ENDSTOPS = 0x02,
+	SETTING_POSDIR = 0x04,
+	SETTING_BATTCOMP = 0x08,
+	SETTING_BATTCURVE = 0x10,
+	SETTING_HEARTBEAT = 0x20,
+	SETTING_CALIBRATION = 0x40,
+	SETTING_ALL = 0x7f
+};
+
+HandTrace::HandTrace()
+{
+	m_file = NULL;
+	memset(&m_settings, 0, sizeof(m_settings));
+	m_hasSettings = false;
+	m_commandCursor = 0;
+	m_calibrationCursor = 0;
+	m_sequenceCursor = 0;
+	m_keepAliveCursor = 0;
+	m_deadmanCursor = 0;
+	m_positionCursor = 0;
+	m_batteryCursor = 0;
+	m_outputCursor = 0;
+	m_lastTick = 0;
+	m_matched = 0;
+	m_mismatches = 0;
+	m_firstMismatch[0] = 0;
+}
+
+HandTrace::~HandTrace()
+{
+	close();
+}
+
+bool HandTrace::openForRecord(const QString &path)
+{
+	close();
+
+	m_file = fopen(path.toLocal8Bit().constData(), "w");
+
+	if (!m_file) {
+		qDebug("HandTrace: could not create %s", path.toLocal8Bit().constData());
+		return false;
+	}
+
+	fprintf(m_file, "# MotorTest trace v3\n");
+
+	return true;
+}
+
+bool HandTrace::openForReplay(const QString &path)
+{
+	QFile file(path);
+
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qDebug("HandTrace: could not open %s", path.toLocal8Bit().constData());
+		return false;
+	}
+
+	int settings = 0;
+
+	while (!file.atEnd()) {
+		QByteArray line = file.readLine();
+		Event event;
+		int a, b, c;
+		char type;
+
+		if (line.size() == 0 || line.constData()[0] == '#')
+			continue;
+
+		if (line.startsWith("O ")) {
+			int setting = parseSetting(line.constData());
+
+			if (setting == 0) {
+				qDebug("HandTrace: bad setting in %s: %s", path.toLocal8Bit().constData(), line.constData());
+				return false;
+			}
+
+			settings |= setting;
+			continue;
+		}
+
+		int fields = sscanf(line.constData(), "%c %d %d %d", &type, &a, &b, &c);
+
+		if (fields < 2)
+			continue;
+
+		event.type = type;
+		event.tick = a;
+		event.value[0] = (fields > 2) ? b : 0;
+		event.value[1] = (fields > 3) ? c : 0;
+
+		if (type == 'C')
+			m_commands.append(event);
+		else if (type == 'K')
+			m_calibrations.append(event);
+		else if (type == 'S')
+			m_sequences.append(event);
+		else if (type == 'A')
+			m_keepAlives.append(event);
+		else if (type == 'D')
+			m_deadmans.append(event);
+		else if (type == 'P')
+			m_positions.append(event);
+		else if (type == 'B')
+			m_battery.append(event);
+		else if (type == 'W' || type == 'G')
+			m_outputs.append(event);
+		else
+			continue;
+
+		if (event.tick > m_lastTick)
+			m_lastTick = event.tick;
+	}
+
+	// half a set would replay with some settings from the trace and some not
+	if (settings != 0 && settings != SETTING_ALL) {
+		qDebug("HandTrace: %s has only some of the settings", path.toLocal8Bit().constData());
+		return false;
+	}
+
+	m_hasSettings = (settings == SETTING_ALL);
+
+	qDebug("HandTrace: replaying %d commands, %d position and %d battery samples, %d outputs",
+		m_commands.size(), m_positions.size(), m_battery.size(), m_outputs.size());
+
+	return true;
+}
+
+void HandTrace::close()
+{
+	if (m_file) {
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+void HandTrace::recordSettings(const TraceSettings &settings)
+{
+	fprintf(m_file, "O stall %d %d\n", settings.stallSamples, settings.stallMinProgress);
+	fprintf(m_file, "O endstops %d %u %u\n", settings.endStopsEnabled ? 1 : 0,
+		settings.endStopMin, settings.endStopMax);
+	fprintf(m_file, "O posdir %s\n", settings.positionIncreasingDir == FINGER_DIR_CLOSE ? "close" : "open");
+	fprintf(m_file, "O battcomp %u %d\n", settings.battNominal, settings.battMaxGain);
+	fprintf(m_file, "O battcurve %d", settings.battCurvePoints);
+
+	for (int i = 0; i < settings.battCurvePoints; i++)
+		fprintf(m_file, " %u %u", settings.battCurveLevel[i], settings.battCurveGain[i]);
+
+	fprintf(m_file, "\n");
+	fprintf(m_file, "O heartbeat %d %d\n", settings.heartbeatWindowMs, settings.heartbeatRampMs);
+	fprintf(m_file, "O calibration %08x\n", settings.calibrationChecksum);
+}
+
+/// fills in m_settings from one O line, returns its SETTING_ bit or 0 if it is bad
+int HandTrace::parseSetting(const char *line)
+{
+	char name[16];
+	int used;
+	unsigned int a, b, c;
+
+	if (sscanf(line, "O %15s %n", name, &used) < 1)
+		return 0;
+
+	const char *values = line + used;
+
+	if (strcmp(name, "stall") == 0) {
+		if (sscanf(values, "%u %u", &a, &b) != 2)
+			return 0;
+
+		m_settings.stallSamples = a;
+		m_settings.stallMinProgress = b;
+
+		return SETTING_STALL;
+	}
+
+	if (strcmp(name, "endstops") == 0) {
+		if (sscanf(values, "%u %u %u", &a, &b, &c) != 3)
+			return 0;
+
+		m_settings.endStopsEnabled = (a != 0);
+		m_settings.endStopMin = b;
+		m_settings.endStopMax = c;
+
+		return SETTING_ENDSTOPS;
+	}
+
+	if (strcmp(name, "posdir") == 0) {
+		if (strncmp(values, "open", 4) == 0)
+			m_settings.positionIncreasingDir = FINGER_DIR_OPEN;
+		else if (strncmp(values, "close", 5) == 0)
+			m_settings.positionIncreasingDir = FINGER_DIR_CLOSE;
+		else
+			return 0;
+
+		return SETTING_POSDIR;
+	}
+
+	if (strcmp(name, "battcomp") == 0) {
+		if (sscanf(values, "%u %u", &a, &b) != 2)
+			return 0;
+
+		m_settings.battNominal = a;
+		m_settings.battMaxGain = b;
+
+		return SETTING_BATTCOMP;
+	}
+
+	if (strcmp(name, "battcurve") == 0) {
+		if (sscanf(values, "%u %n", &a, &used) != 1 || a > (unsigned int) BATT_MAX_CURVE_POINTS)
+			return 0;
+
+		m_settings.battCurvePoints = a;
+
+		for (int i = 0; i < m_settings.battCurvePoints; i++) {
+			values += used;
+
+			if (sscanf(values, "%u %u %n", &b, &c, &used) != 2)
+				return 0;
+
+			m_settings.battCurveLevel[i] = b;
+			m_settings.battCurveGain[i] = c;
+		}
+
+		return SETTING_BATTCURVE;
+	}
+
+	if (strcmp(name, "heartbeat") == 0) {
+		if (sscanf(values, "%u %u", &a, &b) != 2)
+			return 0;
+
+		m_settings.heartbeatWindowMs = a;
+		m_settings.heartbeatRampMs = b;
+
+		return SETTING_HEARTBEAT;
+	}
+
+	if (strcmp(name, "calibration") == 0) {
+		if (sscanf(values, "%x", &a) != 1)
+			return 0;
+
+		m_settings.calibrationChecksum = a;
+
+		return SETTING_CALIBRATION;
+	}
+
+	return 0;
+}
+
+bool HandTrace::settings(TraceSettings *settings)
+{
+	if (!m_hasSettings)
+		return false;
+
+	*settings = m_settings;
+
+	return true;
+}
+
+void HandTrace::recordCommand(quint32 tick, const qint16 *drive)
+{
+	fprintf(m_file, "C %u %d %d\n", tick, drive[0], drive[1]);
+}
+
+void HandTrace::recordCalibration(quint32 tick)
+{
+	fprintf(m_file, "K %u\n", tick);
+}
+
+void HandTrace::recordSequence(quint32 tick)
+{
+	fprintf(m_file, "S %u\n", tick);
+}
+
+void HandTrace::recordKeepAlive(quint32 tick)
+{
+	fprintf(m_file, "A %u\n", tick);
+}
+
+void HandTrace::recordDeadman(quint32 tick)
+{
+	fprintf(m_file, "D %u\n", tick);
+}
+
+void HandTrace::recordPositions(quint32 tick, const quint16 *samples)
+{
+	fprintf(m_file, "P %u %u %u\n", tick, samples[0], samples[1]);
+}
+
+void HandTrace::recordBattery(quint32 tick, quint16 sample)
+{
+	fprintf(m_file, "B %u %u\n", tick, sample);
+}
+
+void HandTrace::recordOutput(quint32 tick, char type, int finger, int value)
+{
+	fprintf(m_file, "%c %u %d %d\n", type, tick, finger, value);
+}
+
+bool HandTrace::nextForTick(QVector<Event> &events, int &cursor, quint32 tick, Event &event)
+{
+	if (cursor >= events.size() || events[cursor].tick != tick)
+		return false;
+
+	event = events[cursor++];
+
+	return true;
+}
+
+bool HandTrace::commandForTick(quint32 tick, qint16 *drive)
+{
+	Event event;
+
+	if (!nextForTick(m_commands, m_commandCursor, tick, event))
+		return false;
+
+	for (int i = 0; i < NUM_FINGERS; i++)
+		drive[i] = event.value[i];
+
+	return true;
+}
+
+bool HandTrace::sequenceForTick(quint32 tick)
+{
+	Event event;
+
+	return nextForTick(m_sequences, m_sequenceCursor, tick, event);
+}
+
+bool HandTrace::keepAliveForTick(quint32 tick)
+{
+	Event event;
+
+	return nextForTick(m_keepAlives, m_keepAliveCursor, tick, event);
+}
+
+bool HandTrace::deadmanForTick(quint32 tick)
+{
+	Event event;
+
+	return nextForTick(m_deadmans, m_deadmanCursor, tick, event);
+}
+
+bool HandTrace::calibrationForTick(quint32 tick)
+{
+	Event event;
+
+	return nextForTick(m_calibrations, m_calibrationCursor, tick, event);
+}
+
+bool HandTrace::positionsForTick(quint32 tick, quint16 *samples)
+{
+	Event event;
+
+	if (!nextForTick(m_positions, m_positionCursor, tick, event))
+		return false;
+
+	for (int i = 0; i < NUM_FINGERS; i++)
+		samples[i] = event.value[i];
+
+	return true;
+}
+
+bool HandTrace::batteryForTick(quint32 tick, quint16 *sample)
+{
+	Event event;
+
+	if (!nextForTick(m_battery, m_batteryCursor, tick, event))
+		return false;
+
+	*sample = event.value[0];
+
+	return true;
+}
+
+void HandTrace::checkOutput(quint32 tick, char type, int finger, int value)
+{
+	if (m_outputCursor < m_outputs.size()) {
+		const Event &expected = m_outputs[m_outputCursor++];
+
+		if (expected.type == type && expected.tick == tick
+				&& expected.value[0] == finger && expected.value[1] == value) {
+			m_matched++;
+			return;
+		}
+
+		if (m_mismatches == 0)
+			snprintf(m_firstMismatch, sizeof(m_firstMismatch), "expected %c %u %d %d, got %c %u %d %d",
+				expected.type, expected.tick, expected.value[0], expected.value[1],
+				type, tick, finger, value);
+	}
+	else if (m_mismatches == 0) {
+		snprintf(m_firstMismatch, sizeof(m_firstMismatch), "unexpected %c %u %d %d after the end of the trace",
+			type, tick, finger, value);
+	}
+
+	m_mismatches++;
+}
+
+bool HandTrace::finished(quint32 tick)
+{
+	return tick > m_lastTick;
+}
+
+int HandTrace::mismatches()
+{
+	// outputs the trace expected that were never produced count too
+	return m_mismatches + (m_outputs.size() - m_outputCursor);
+}
+
+void HandTrace::report()
+{
+	int missing = m_outputs.size() - m_outputCursor;
+
+	if (mismatches() == 0) {
+		qDebug("HandTrace: replay matched, %d outputs over %u ticks", m_matched, m_lastTick);
+		return;
+	}
+
+	qDebug("HandTrace: replay FAILED, %d outputs matched, %d differed, %d missing",
+		m_matched, m_mismatches, missing);
+
+	if (m_mismatches > 0)
+		qDebug("HandTrace: first difference: %s", m_firstMismatch);
+}
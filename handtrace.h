@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef HANDTRACE_H
+#define HANDTRACE_H
+
+#include <stdio.h>
+
+#include <QString>
+#include <QVector>
+
+#include "handcontrolthread.h"
+
+/// Loop settings that change what the control loop outputs, so a trace can be
+/// replayed on its own; the calibration tables are too big to carry, so only
+/// their checksum is, to refuse a replay with a different table
+struct TraceSettings
+{
+	int stallSamples;
+	int stallMinProgress;
+	bool endStopsEnabled;
+	quint16 endStopMin;
+	quint16 endStopMax;
+	FingerDir positionIncreasingDir;
+	quint16 battNominal;
+	int battMaxGain;                ///< percent, as SetBatteryCompensation takes it
+	int battCurvePoints;
+	quint16 battCurveLevel[BATT_MAX_CURVE_POINTS];
+	quint16 battCurveGain[BATT_MAX_CURVE_POINTS];
+	int heartbeatWindowMs;
+	int heartbeatRampMs;
+	quint32 calibrationChecksum;
+};
+
+/// Record/replay of everything that goes in and out of the control loop.
+///
+/// The trace is a text file. It starts with the settings the loop ran with,
+/// one per line (see TraceSettings):
+///   O stall <samples> <min progress>
+///   O endstops <enabled> <min> <max>
+///   O posdir <open|close>
+///   O battcomp <nominal> <max gain %>
+///   O battcurve <points> <level> <gain %> ...
+///   O heartbeat <window ms> <ramp ms>
+///   O calibration <checksum>
+/// followed by one event per line, each stamped with the control loop tick it
+/// happened on:
+///   C <tick> <drive0> <drive1>   command applied by the control loop
+///   K <tick>                     calibration sweep started
+///   S <tick>                     motion sequence started (the same sequence has to be
+///                                loaded to replay it, see HandControlThread::RunSequence)
+///   A <tick>                     keepalive, see HandControlThread::KeepAlive
+///   D <tick>                     heartbeat window ran out, timed on the clock, see
+///                                HandControlThread::SetHeartbeat
+///   P <tick> <raw0> <raw1>       finger position sample
+///   B <tick> <raw>               battery sample
+///   W <tick> <finger> <value>    PWM write
+///   G <tick> <finger> <value>    direction GPIO write
+/// Lines starting with # are comments.
+///
+/// Replaying puts the recorded settings back, feeds the C, K, S, A, D, P and B events back
+/// in on the same ticks and checks the W and G events produced match the recorded ones
+/// exactly. A trace from before the settings were recorded replays with the current ones.
+class HandTrace
+{
+public:
+	HandTrace();
+	~HandTrace();
+
+	bool openForRecord(const QString &path);
+	bool openForReplay(const QString &path);
+	void close();
+
+	// recording, the settings first
+	void recordSettings(const TraceSettings &settings);
+	void recordCommand(quint32 tick, const qint16 *drive);
+	void recordCalibration(quint32 tick);
+	void recordSequence(quint32 tick);
+	void recordKeepAlive(quint32 tick);
+	void recordDeadman(quint32 tick);
+	void recordPositions(quint32 tick, const quint16 *samples);
+	void recordBattery(quint32 tick, quint16 sample);
+	void recordOutput(quint32 tick, char type, int finger, int value);
+
+	/// the settings the trace was recorded with, false if it has none
+	bool settings(TraceSettings *settings);
+
+	// replay, each returns false if the trace has nothing for this tick
+	bool commandForTick(quint32 tick, qint16 *drive);
+	bool calibrationForTick(quint32 tick);
+	bool sequenceForTick(quint32 tick);
+	bool keepAliveForTick(quint32 tick);
+	bool deadmanForTick(quint32 tick);
+	bool positionsForTick(quint32 tick, quint16 *samples);
+	bool batteryForTick(quint32 tick, quint16 *sample);
+	void checkOutput(quint32 tick, char type, int finger, int value);
+
+	/// true once tick is past the last event in the trace
+	bool finished(quint32 tick);
+
+	/// number of outputs that differed from, or were missing from, the trace
+	int mismatches();
+
+	/// logs the replay result
+	void report();
+
+private:
+	struct Event
+	{
+		char type;
+		quint32 tick;
+		qint32 value[NUM_FINGERS];
+	};
+
+	bool nextForTick(QVector<Event> &events, int &cursor, quint32 tick, Event &event);
+	int parseSetting(const char *line);
+
+	FILE *m_file;
+
+	TraceSettings m_settings;
+	bool m_hasSettings;
+
+	QVector<Event> m_commands;
+	QVector<Event> m_calibrations;
+	QVector<Event> m_sequences;
+	QVector<Event> m_keepAlives;
+	QVector<Event> m_deadmans;
+	QVector<Event> m_positions;
+	QVector<Event> m_battery;
+	QVector<Event> m_outputs;
+
+	int m_commandCursor;
+	int m_calibrationCursor;
+	int m_sequenceCursor;
+	int m_keepAliveCursor;
+	int m_deadmanCursor;
+	int m_positionCursor;
+	int m_batteryCursor;
+	int m_outputCursor;
+
+	quint32 m_lastTick;
+	int m_matched;
+	int m_mismatches;
+	char m_firstMismatch[100];
+};
+
+#endif // HANDTRACE_H
@@ -4,18 +4,40 @@
  */
 
 #include "motortest.h"
+#include "rigwindow.h"
+#include "rigbench.h"
 #include <qapplication.h>
+#include <string.h>
 
 int main(int argc, char *argv[])
 {
+	// the rig benchmark runs from the console, with no window
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-rigbench")) {
+			QCoreApplication a(argc, argv);
+			return RigBench::run(a.arguments());
+		}
+	}
+
 	QApplication a(argc, argv);
-	MotorTest w;
-	w.show();
+	QWidget *w;
+
+	// a test rig of several hands, or the normal single hand window
+	if (a.arguments().contains("-rig"))
+		w = new RigWindow;
+	else
+		w = new MotorTest;
+
+	w->show();
 
 // only works with Qt4
 #ifdef Q_WS_QWS
-	w.showFullScreen();
+	w->showFullScreen();
 #endif
 
-	return a.exec();
+	int ret = a.exec();
+
+	delete w;
+
+	return ret;
 }
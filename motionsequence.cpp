@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <string.h>
+
+#include <QFile>
+#include <QStringList>
+
+#include "motionsequence.h"
+
+/// deepest nesting of loop blocks
+const int SEQ_MAX_LOOP_DEPTH = 8;
+
+MotionSequence::MotionSequence()
+{
+	m_count = 0;
+	memset(m_steps, 0, sizeof(m_steps));
+}
+
+bool MotionSequence::parseFinger(const QString &field, qint8 *finger)
+{
+	if (field == "all") {
+		*finger = -1;
+		return true;
+	}
+
+	bool ok;
+	int n = field.toInt(&ok);
+
+	if (!ok || n < 1 || n > NUM_FINGERS)
+		return false;
+
+	*finger = n - 1;
+
+	return true;
+}
+
+bool MotionSequence::load(const QString &path)
+{
+	QFile file(path);
+
+	m_count = 0;
+
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qDebug("MotionSequence: could not open %s", path.toLocal8Bit().constData());
+		return false;
+	}
+
+	int loopStart[SEQ_MAX_LOOP_DEPTH];
+	int loopDepth = 0;
+	int lineNum = 0;
+	int count = 0;
+	const char *error = NULL;
+
+	while (!file.atEnd() && !error) {
+		QString line = QString(file.readLine());
+		lineNum++;
+
+		int comment = line.indexOf('#');
+
+		if (comment >= 0)
+			line = line.left(comment);
+
+		line = line.simplified();
+
+		if (line.isEmpty())
+			continue;
+
+		QStringList fields = line.split(' ');
+		QString op = fields.at(0);
+		bool ok = true;
+
+		if (op == "loop") {
+			if (loopDepth >= SEQ_MAX_LOOP_DEPTH)
+				error = "loops nested too deep";
+			else
+				loopStart[loopDepth++] = count;
+
+			continue;
+		}
+
+		if (count >= SEQ_MAX_STEPS) {
+			error = "too many steps";
+			break;
+		}
+
+		SequenceStep &step = m_steps[count];
+		memset(&step, 0, sizeof(step));
+		step.finger = -1;
+
+		if (op == "drive" && (fields.size() == 2 || fields.size() == NUM_FINGERS + 1)) {
+			step.op = SEQ_DRIVE;
+
+			for (int i = 0; i < NUM_FINGERS && ok; i++) {
+				int level = fields.at(fields.size() == 2 ? 1 : i + 1).toInt(&ok);
+				ok = ok && level >= -100 && level <= 100;
+				step.level[i] = level;
+			}
+		}
+		else if (op == "move" && fields.size() == 4) {
+			bool levelOk, positionOk;
+			int level = fields.at(3).toInt(&levelOk);
+
+			step.op = SEQ_MOVE;
+			step.position = fields.at(2).toUShort(&positionOk);
+			ok = levelOk && positionOk && level > 0 && level <= 100
+				&& parseFinger(fields.at(1), &step.finger);
+
+			for (int i = 0; i < NUM_FINGERS; i++)
+				step.level[i] = level;
+		}
+		else if (op == "dwell" && fields.size() == 2) {
+			step.op = SEQ_DWELL;
+			step.ms = fields.at(1).toUInt(&ok);
+		}
+		else if (op == "wait" && fields.size() == 2 && fields.at(1) == "stopped") {
+			step.op = SEQ_WAIT_STOPPED;
+		}
+		else if (op == "wait" && fields.size() == 4 && (fields.at(1) == "above" || fields.at(1) == "below")) {
+			step.op = (fields.at(1) == "above") ? SEQ_WAIT_ABOVE : SEQ_WAIT_BELOW;
+			step.position = fields.at(3).toUShort(&ok);
+			ok = ok && parseFinger(fields.at(2), &step.finger);
+		}
+		else if (op == "repeat" && fields.size() == 2) {
+			step.op = SEQ_REPEAT;
+			step.count = fields.at(1).toUShort(&ok);
+
+			if (loopDepth == 0)
+				error = "repeat without loop";
+			else
+				step.jump = loopStart[--loopDepth];
+		}
+		else {
+			error = "not a step";
+		}
+
+		if (!ok && !error)
+			error = "bad value";
+
+		count++;
+	}
+
+	if (!error && loopDepth > 0)
+		error = "loop without repeat";
+
+	if (error) {
+		qDebug("MotionSequence: %s line %d: %s", path.toLocal8Bit().constData(), lineNum, error);
+		return false;
+	}
+
+	m_count = count;
+
+	return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef MOTIONSEQUENCE_H
+#define MOTIONSEQUENCE_H
+
+#include <QString>
+
+#include "handcontrolthread.h"
+
+/// What a sequence step does, see MotionSequence
+enum SequenceOp
+{
+	SEQ_DRIVE,          ///< set the drive level, done at once
+	SEQ_MOVE,           ///< drive towards a position and stop there
+	SEQ_DWELL,          ///< wait a time
+	SEQ_WAIT_STOPPED,   ///< wait until the drive is off (a move done, a stall ...)
+	SEQ_WAIT_ABOVE,     ///< wait until the position is at or above a value
+	SEQ_WAIT_BELOW,     ///< wait until the position is at or below a value
+	SEQ_REPEAT          ///< go back to a step a number of times
+};
+
+/// One compiled step, fixed size so the control thread never allocates
+struct SequenceStep
+{
+	quint8 op;                      ///< SequenceOp
+	qint8 finger;                   ///< finger the step applies to, -1 for all
+	qint16 level[NUM_FINGERS];      ///< drive level, as SetFingerDrive
+	quint16 position;               ///< target or threshold position
+	quint16 count;                  ///< repeats, 0 for forever
+	qint16 jump;                    ///< step a repeat goes back to
+	quint32 ms;                     ///< dwell length
+};
+
+/// A test procedure compiled from a text file into a table of steps that
+/// HandControlThread runs tick by tick.
+///
+/// One step per line, fingers are 1 - NUM_FINGERS or "all", # starts a comment:
+///   drive <level> [<level> ...]   drive levels as SetFingerDrive, one for all or one per finger
+///   move <finger> <position> <level>  drive towards position at level, stop on reaching it
+///   dwell <msec>
+///   wait stopped
+///   wait above|below <finger> <position>
+///   loop                          start of a block for repeat
+///   repeat <count>                run the block since the matching loop count more times, 0 for forever
+/// Steps that take no time (drive, repeat, a wait already met) all run in the
+/// same tick.
+class MotionSequence
+{
+public:
+	MotionSequence();
+
+	/// compiles path, on an error logs it and leaves the sequence empty
+	bool load(const QString &path);
+
+	int count() const { return m_count; }
+	const SequenceStep &step(int index) const { return m_steps[index]; }
+
+private:
+	bool parseFinger(const QString &field, qint8 *finger);
+
+	SequenceStep m_steps[SEQ_MAX_STEPS];
+	int m_count;
+};
+
+#endif // MOTIONSEQUENCE_H
@@ -6,16 +6,29 @@
 #include <qboxlayout.h>
 #include <qgroupbox.h>
 #include <qformlayout.h>
+#include <qapplication.h>
+#include <qfiledialog.h>
 
 #include "motortest.h"
 #include "motorspeeddlg.h"
+#include "handclock.h"
+#include "motionsequence.h"
 
 #define DIR_OPEN 0
 #define DIR_CLOSE 1
 
+// display frame period (msec) when polling for the hand state, the control
+// thread updates its snapshot no faster
+#define FRAME_MS 33
+
 MotorTest::MotorTest(QWidget *parent)
 	: QMainWindow(parent)
 {
+	m_startupTimer.start();
+	m_hardwareReady = false;
+	m_firstFrameShown = false;
+	m_firstStateShown = false;
+
 	ui.setupUi(this);
 	layoutWindow();
 	initControls();
@@ -24,8 +37,21 @@ MotorTest::MotorTest(QWidget *parent)
 
 	m_runSpeed = 70;
 	m_running = false;
-	m_newBatteryData = false;
-	m_newFingerPosData = false;
+	m_calibrating = false;
+	m_directionPending = false;
+	m_fingerRunning[0] = false;
+	m_fingerRunning[1] = false;
+	m_shownPosition[0] = -1;
+	m_shownPosition[1] = -1;
+	m_shownBattery = -1;
+	m_shownGain = -1;
+	m_labelUpdates = 0;
+	m_plotSeq = 0;
+	m_sequenceActive = false;
+	m_sequenceSteps = 0;
+	m_shownSequenceStep = -1;
+	m_stateNotifier = NULL;
+	m_keepAliveMs = 0;
 
 	connect(m_actionExit, SIGNAL(clicked()), SLOT(close()));
 	connect(m_actionStart, SIGNAL(clicked()), SLOT(onStart()));
@@ -34,63 +60,502 @@ MotorTest::MotorTest(QWidget *parent)
 
 	m_handThread = new HandControlThread();
 
-	connect(m_handThread, SIGNAL(fingerPositionUpdated()), SLOT(fingerPositionUpdated()));
-	connect(m_handThread, SIGNAL(batteryLevelUpdated()), SLOT(batteryLevelUpdated()));
+	connect(m_handThread, SIGNAL(hardwareReady(bool)), SLOT(onHardwareReady(bool)));
+	connect(m_handThread, SIGNAL(finished()), SLOT(onHandThreadFinished()));
+	connect(m_handThread, SIGNAL(fingerStalled(int)), SLOT(onFingerStalled(int)));
+	connect(m_handThread, SIGNAL(fingerEndStop(int)), SLOT(onFingerEndStop(int)));
+	connect(m_handThread, SIGNAL(calibrationFinished(bool)), SLOT(onCalibrationFinished(bool)));
+	connect(m_handThread, SIGNAL(sequenceFinished(bool)), SLOT(onSequenceFinished(bool)));
+	connect(m_handThread, SIGNAL(heartbeatLost()), SLOT(onHeartbeatLost()));
 
-	m_handThread->startThread();
+	configureHandThread();
 
-	m_timer = startTimer(100);
+	// the window is up straight away, the controls wait for the hardware
+	updateControls();
+	m_runStatusLbl->setText("Hardware initialising");
+
+	// the control thread pokes a pipe when it has published a new state, so
+	// the GUI sleeps while nothing changes, as the control thread does when idle
+	int fd = m_handThread->StateNotifierFd();
+
+	if (fd >= 0) {
+		m_stateNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+		connect(m_stateNotifier, SIGNAL(activated(int)), SLOT(onStateReady()));
+	}
+	else {
+		connect(&m_pollTimer, SIGNAL(timeout()), SLOT(onStateReady()));
+		m_pollTimer.start(FRAME_MS);
+	}
+
+	connect(&m_keepAliveTimer, SIGNAL(timeout()), SLOT(onKeepAlive()));
+
+	m_handThread->startThread();
 }
 
 MotorTest::~MotorTest()
 {
 }
 
-void MotorTest::closeEvent(QCloseEvent *)
+// the timer only fires once the event loop is back, after the paint the show
+// has queued, so this is when the window is really up
+void MotorTest::showEvent(QShowEvent *event)
 {
-	killTimer(m_timer);
+	QMainWindow::showEvent(event);
 
+	if (!m_firstFrameShown) {
+		m_firstFrameShown = true;
+		QTimer::singleShot(0, this, SLOT(onFirstFrame()));
+	}
+}
+
+void MotorTest::onFirstFrame()
+{
+	qDebug("Startup: first frame %lld ms after start", m_startupTimer.elapsed());
+}
+
+void MotorTest::closeEvent(QCloseEvent *)
+{
+	m_pollTimer.stop();
+	m_keepAliveTimer.stop();
 	m_handThread->stopThread();
+
+	logLoopStats(m_plot->isVisible() ? "plot visible" : "plot hidden");
+
+	UpdateStats updateStats;
+	m_handThread->GetUpdateStats(&updateStats);
+
+	// the old path queued one GUI event per sample
+	qDebug("GUI updates: %u snapshots for %u samples, %u label updates",
+		updateStats.statesPublished, updateStats.samplesProduced, m_labelUpdates);
+
+	LimitStats limitStats;
+	m_handThread->GetLimitStats(&limitStats);
+
+	if (limitStats.stalls + limitStats.endStops > 0)
+		qDebug("Limits: %u stalls, %u end-stops, reaction last %u us, max %u us",
+			limitStats.stalls, limitStats.endStops, limitStats.lastReactionUs, limitStats.maxReactionUs);
+
+	PwmStats pwmStats;
+	m_handThread->GetPwmStats(&pwmStats);
+
+	qDebug("PWM: %u values set, %u device writes", pwmStats.requested, pwmStats.written);
+
+	DeadmanStats deadmanStats;
+	m_handThread->GetDeadmanStats(&deadmanStats);
+
+	if (deadmanStats.trips > 0)
+		qDebug("Heartbeat: %u drives ramped down, deadline to PWM zero last %u us, max %u us",
+			deadmanStats.trips, deadmanStats.lastLatencyUs, deadmanStats.maxLatencyUs);
+
+	IdleStats stats;
+	m_handThread->GetIdleStats(&stats);
+
+	if (stats.idleTimeMs > 0)
+		qDebug("Idle: %u wakeups in %u ms (%u/s), %u resumes, resume latency last %u us, max %u us",
+			stats.idleWakeups, stats.idleTimeMs, (stats.idleWakeups * 1000) / stats.idleTimeMs,
+			stats.resumeCount, stats.lastResumeLatencyUs, stats.maxResumeLatencyUs);
 }
 
-void MotorTest::timerEvent(QTimerEvent *)
+// the control thread only leaves a snapshot and pokes the pipe, posting to the
+// GUI would allocate on every update
+void MotorTest::onStateReady()
 {
-	quint16 data[2];
+	HandState state;
 
-	if (m_newBatteryData) {
-		data[0] = m_handThread->GetBatteryLevel();
-		m_batteryLevelLbl->setText(QString::number(data[0]));
+	if (m_handThread->TakeState(&state)) {
+		if (!m_firstStateShown) {
+			m_firstStateShown = true;
+			qDebug("Startup: first sample shown %lld ms after start", m_startupTimer.elapsed());
+		}
+
+		showState(state);
 	}
+}
 
-	if (m_newFingerPosData) { 
-		m_handThread->GetFingerPos(data);
-		m_positionLbl[0]->setText(QString::number(data[0]));
-		m_positionLbl[1]->setText(QString::number(data[1]));
+// while the GUI keeps running it is alive, if it hangs the deadman stops the fingers
+void MotorTest::onKeepAlive()
+{
+	m_handThread->KeepAlive();
+}
+
+void MotorTest::onHardwareReady(bool ok)
+{
+	m_hardwareReady = ok;
+
+	qDebug("Startup: hardware %s %lld ms after start", ok ? "ready" : "failed", m_startupTimer.elapsed());
+
+	if (!ok) {
+		m_runStatusLbl->setText("Hardware failed");
+		return;
 	}
+
+	updateControls();
+	m_runStatusLbl->setText("Stopped");
 }
 
-void MotorTest::batteryLevelUpdated()
+void MotorTest::showState(const HandState &state)
 {
-	QMutexLocker lock(&m_newBatteryDataMutex);
-	m_newBatteryData = true;
+	if (state.batteryLevel != m_shownBattery || state.driveGain != m_shownGain) {
+		m_shownBattery = state.batteryLevel;
+		m_shownGain = state.driveGain;
+
+		// the drive scale only shows while the compensation is doing something
+		if (m_shownGain != 100)
+			m_batteryLevelLbl->setText(QString("%1 (x%2%)").arg(m_shownBattery).arg(m_shownGain));
+		else
+			m_batteryLevelLbl->setText(QString::number(m_shownBattery));
+
+		m_labelUpdates++;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (state.position[i] != m_shownPosition[i]) {
+			m_shownPosition[i] = state.position[i];
+			m_positionLbl[i]->setText(QString::number(m_shownPosition[i]));
+			m_labelUpdates++;
+		}
+	}
+
+	if (m_sequenceActive && state.sequenceStep >= 0 && state.sequenceStep != m_shownSequenceStep) {
+		m_shownSequenceStep = state.sequenceStep;
+
+		if (state.sequenceLastStep >= 0)
+			m_runStatusLbl->setText(QString("Step %1/%2 (%3: %4 ms)")
+				.arg(state.sequenceStep + 1).arg(m_sequenceSteps)
+				.arg(state.sequenceLastStep + 1).arg(state.sequenceLastStepMs));
+		else
+			m_runStatusLbl->setText(QString("Step %1/%2").arg(state.sequenceStep + 1).arg(m_sequenceSteps));
+
+		m_labelUpdates++;
+	}
+
+	// the plot wants every sample, not just the newest, on the scale the
+	// positions are in (raw samples until the hand is calibrated)
+	FingerSample samples[32];
+	int count;
+
+	m_plot->setPositionRange(state.positionMax);
+
+	while ((count = m_handThread->fetchSince(m_plotSeq, samples, 32)) > 0) {
+		m_plot->addSamples(samples, count);
+		m_plotSeq = samples[count - 1].seq;
+	}
+}
+
+void MotorTest::onPlot(bool show)
+{
+	// close out the jitter figures for the mode we are leaving
+	logLoopStats(show ? "plot hidden" : "plot visible");
+	m_handThread->ResetLoopStats();
+
+	m_plot->setVisible(show);
+}
+
+// the control thread sweeps both fingers end to end, the operator controls
+// stay off until it is done
+void MotorTest::onCalibrate()
+{
+	if (m_running)
+		onStop();
+
+	m_calibrating = true;
+	updateControls();
+
+	m_handThread->StartCalibration();
+	m_runStatusLbl->setText("Calibrating");
+}
+
+// the control thread leaves the saving to us, so it does no file I/O while
+// the loop is running
+void MotorTest::onCalibrationFinished(bool ok)
+{
+	m_calibrating = false;
+	updateControls();
+
+	if (ok && !m_handThread->SaveCalibration())
+		m_runStatusLbl->setText("Calibration not saved");
+	else
+		m_runStatusLbl->setText(ok ? "Calibrated" : "Calibration failed");
+}
+
+// runs the -seq file, or one picked here, on the control thread; Stop
+// cancels it like any other drive command
+void MotorTest::onSequence()
+{
+	QString path = m_sequenceFile;
+
+	if (path.isEmpty())
+		path = QFileDialog::getOpenFileName(this, "Motion sequence");
+
+	if (path.isEmpty())
+		return;
+
+	MotionSequence sequence;
+
+	if (!sequence.load(path) || sequence.count() == 0) {
+		m_runStatusLbl->setText("Bad sequence");
+		return;
+	}
+
+	if (m_running)
+		onStop();
+
+	m_sequenceActive = true;
+	updateControls();
+
+	m_sequenceSteps = sequence.count();
+	m_shownSequenceStep = -1;
+	m_handThread->RunSequence(sequence);
+	m_runStatusLbl->setText("Sequence");
+}
+
+void MotorTest::onSequenceFinished(bool ok)
+{
+	m_sequenceActive = false;
+	updateControls();
+
+	m_shownSequenceStep = -1;
+	m_runStatusLbl->setText(ok ? "Sequence done" : "Sequence stopped");
 }
 
-void MotorTest::fingerPositionUpdated()
+// the controls that start a drive are only on once the hardware is up and
+// while nothing else is driving the hand; Start also waits for a new
+// direction to be applied
+void MotorTest::updateControls()
 {
-	QMutexLocker lock(&m_newFingerPosDataMutex);
-	m_newFingerPosData = true;
+	bool handFree = m_hardwareReady && !m_calibrating && !m_sequenceActive;
+	bool canStart = handFree && !m_running && !m_directionPending;
+
+	m_directionBtn[DIR_OPEN]->setEnabled(!m_running);
+	m_directionBtn[DIR_CLOSE]->setEnabled(!m_running);
+	m_applyDirectionBtn->setEnabled(m_directionPending);
+	m_actionStart->setEnabled(canStart);
+	m_actionSpeed->setEnabled(canStart);
+	m_calibrateBtn->setEnabled(handFree);
+	m_sequenceBtn->setEnabled(handFree);
+}
+
+void MotorTest::logLoopStats(const char *label)
+{
+	LoopStats stats;
+	m_handThread->GetLoopStats(&stats);
+
+	if (stats.ticks > 0)
+		qDebug("Loop jitter (%s): %u ticks, avg %u us, max %u us late", label,
+			stats.ticks, (quint32) (stats.totalLateUs / stats.ticks), stats.maxLateUs);
+}
+
+void MotorTest::onHandThreadFinished()
+{
+	// bring-up failed, stay up to say so
+	if (!m_hardwareReady)
+		return;
+
+	// the thread only stops by itself at the end of a timed (-simtime) run or a replay
+	if (isVisible())
+		close();
+
+	// a replay that did not match, or a loop that allocated, fails the run
+	if (m_handThread->ReplayMismatches() > 0 || m_handThread->LoopAllocations() > 0)
+		QApplication::exit(1);
+}
+
+void MotorTest::onFingerStalled(int finger)
+{
+	fingerStopped(finger, "stalled");
+}
+
+void MotorTest::onFingerEndStop(int finger)
+{
+	fingerStopped(finger, "at end-stop");
+}
+
+// the control thread is ramping the drive down by itself, this only catches
+// up once the GUI is running again
+void MotorTest::onHeartbeatLost()
+{
+	if (!m_running)
+		return;
+
+	m_fingerRunning[0] = false;
+	m_fingerRunning[1] = false;
+	onStop();
+
+	m_runStatusLbl->setText("Heartbeat lost");
+}
+
+// the control thread has already cut the drive, once both fingers are
+// stopped put the controls back as if Stop was pressed
+void MotorTest::fingerStopped(int finger, const char *reason)
+{
+	if (!m_running || finger < 0 || finger > 1)
+		return;
+
+	m_fingerRunning[finger] = false;
+
+	if (!m_fingerRunning[0] && !m_fingerRunning[1])
+		onStop();
+
+	m_runStatusLbl->setText(QString("Motor %1 %2").arg(finger + 1).arg(reason));
+}
+
+// Command line options for the control thread
+//   -simclock        simulated hand on a virtual clock, running as fast as possible
+//   -simtime <sec>   stop after this many seconds of clock time
+//   -record <file>   record commands, sensor samples and outputs to a trace
+//   -replay <file>   replay a trace flat out and check the outputs match, with
+//                    the settings it was recorded with in place of the ones
+//                    given here; -calfile has to give the same calibration
+//   -stall <samples> position samples without progress before a drive is cut, 0 for off
+//   -endstops <min> <max>  soft end-stop positions
+//   -posdir <open|close>  drive direction that makes the position reading go up,
+//                    open by default; check it on the hand before using -endstops
+//   -calfile <file>  position calibration to load, and where a new one is saved
+//   -battcomp <nominal> <max %>  scale the drive by nominal / battery level, up
+//                    to max percent, so the fingers keep their speed as it sags
+//   -battcurve <level>:<percent>,...  measured scale against battery level in
+//                    place of nominal / level, with -battcomp
+//   -pwm <pwm 1> <pwm 2>  PWM outputs, /dev/pwm<n> devices or sysfs channels
+//                    (/sys/class/pwm/pwmchip<n>/pwm<m>)
+//   -pwmfreq <Hz>    PWM frequency for sysfs channels, 5000 - 10000
+//   -heartbeat <ms> <ramp ms>  ramp the drive down when the GUI has not been
+//                    heard from for this long
+//   -seq <file>      motion sequence for the Seq button; with -replay, the
+//                    sequence the trace was recorded running
+//   -verbose         log every output write from the control thread
+void MotorTest::configureHandThread()
+{
+	QStringList args = QApplication::arguments();
+
+#ifdef Q_WS_QWS
+	QString calFile = "/etc/motortest.cal";
+#else
+	QString calFile = "motortest.cal";
+#endif
+
+	int i = args.indexOf("-calfile");
+
+	if (i >= 0 && i + 1 < args.size())
+		calFile = args.at(i + 1);
+
+	m_handThread->SetCalibrationFile(calFile);
+
+	if (args.contains("-verbose"))
+		m_handThread->SetVerbose(true);
+
+	if (args.contains("-simclock")) {
+		m_handThread->SetSimulated(true);
+		m_handThread->SetClock(new VirtualClock);
+	}
+
+	i = args.indexOf("-simtime");
+
+	if (i >= 0 && i + 1 < args.size())
+		m_handThread->SetRunTime(args.at(i + 1).toInt() * 1000LL);
+
+	i = args.indexOf("-record");
+
+	if (i >= 0 && i + 1 < args.size())
+		m_handThread->SetRecordFile(args.at(i + 1));
+
+	i = args.indexOf("-stall");
+
+	if (i >= 0 && i + 1 < args.size())
+		m_handThread->SetStallDetection(args.at(i + 1).toInt(), 1);
+
+	i = args.indexOf("-endstops");
+
+	if (i >= 0 && i + 2 < args.size())
+		m_handThread->SetEndStops(args.at(i + 1).toInt(), args.at(i + 2).toInt());
+
+	i = args.indexOf("-posdir");
+
+	if (i >= 0 && i + 1 < args.size()) {
+		if (args.at(i + 1) == "open")
+			m_handThread->SetPositionDirection(FINGER_DIR_OPEN);
+		else if (args.at(i + 1) == "close")
+			m_handThread->SetPositionDirection(FINGER_DIR_CLOSE);
+		else
+			qDebug("MotorTest: -posdir takes open or close");
+	}
+
+	HandDevices devices;
+
+	i = args.indexOf("-pwm");
+
+	if (i >= 0 && i + 2 < args.size()) {
+		devices.pwm[0] = args.at(i + 1).toLocal8Bit();
+		devices.pwm[1] = args.at(i + 2).toLocal8Bit();
+	}
+
+	i = args.indexOf("-pwmfreq");
+
+	if (i >= 0 && i + 1 < args.size())
+		devices.pwmFrequencyHz = args.at(i + 1).toInt();
+
+	m_handThread->SetDevices(devices);
+
+	i = args.indexOf("-heartbeat");
+
+	if (i >= 0 && i + 2 < args.size()) {
+		m_handThread->SetHeartbeat(args.at(i + 1).toInt(), args.at(i + 2).toInt());
+
+		// a few keepalives to each window, so one late one does not trip it
+		m_keepAliveMs = qMax(args.at(i + 1).toInt() / 3, 1);
+	}
+
+	i = args.indexOf("-battcomp");
+
+	if (i >= 0 && i + 2 < args.size())
+		m_handThread->SetBatteryCompensation(args.at(i + 1).toInt(), args.at(i + 2).toInt());
+
+	i = args.indexOf("-battcurve");
+
+	if (i >= 0 && i + 1 < args.size()) {
+		QStringList points = args.at(i + 1).split(',');
+		quint16 levels[BATT_MAX_CURVE_POINTS];
+		quint16 gains[BATT_MAX_CURVE_POINTS];
+		int n;
+
+		for (n = 0; n < points.size() && n < BATT_MAX_CURVE_POINTS; n++) {
+			QStringList point = points.at(n).split(':');
+
+			if (point.size() != 2)
+				break;
+
+			levels[n] = point.at(0).toInt();
+			gains[n] = point.at(1).toInt();
+		}
+
+		if (n != points.size() || !m_handThread->SetBatteryCurve(levels, gains, n))
+			qDebug("MotorTest: bad -battcurve, using nominal / level");
+	}
+
+	i = args.indexOf("-replay");
+
+	if (i >= 0 && i + 1 < args.size() && m_handThread->SetReplayFile(args.at(i + 1)))
+		m_handThread->SetClock(new VirtualClock);
+
+	i = args.indexOf("-seq");
+
+	if (i >= 0 && i + 1 < args.size()) {
+		m_sequenceFile = args.at(i + 1);
+
+		// a replay starts it on the tick the trace says
+		MotionSequence sequence;
+
+		if (args.contains("-replay") && sequence.load(m_sequenceFile)) {
+			m_sequenceActive = true;
+			m_sequenceSteps = sequence.count();
+			m_handThread->RunSequence(sequence);
+		}
+	}
 }
 
 void MotorTest::onStart()
 {
 	qint16 speed[2];
 
-    m_directionBtn[DIR_OPEN]->setEnabled(false);
-    m_directionBtn[DIR_CLOSE]->setEnabled(false);
-	m_applyDirectionBtn->setEnabled(false);
-	m_actionStart->setEnabled(false);
-	m_actionSpeed->setEnabled(false);
-
     if (m_directionBtn[DIR_OPEN]->isChecked())
         speed[0] = m_runSpeed;
 	else
@@ -100,6 +565,13 @@ void MotorTest::onStart()
 
 	m_handThread->SetFingerDrive(speed);
 	m_running = true;
+	m_fingerRunning[0] = true;
+	m_fingerRunning[1] = true;
+	updateControls();
+
+	if (m_keepAliveMs > 0)
+		m_keepAliveTimer.start(m_keepAliveMs);
+
 	m_runStatusLbl->setText("Running");
 }
 
@@ -107,17 +579,17 @@ void MotorTest::onStop()
 {
 	qint16 speed[2];
 
-    m_directionBtn[DIR_OPEN]->setEnabled(true);
-    m_directionBtn[DIR_CLOSE]->setEnabled(true);
-	m_actionStart->setEnabled(true);
-	m_actionSpeed->setEnabled(true);
-
 	speed[0] = 0;
 	speed[1] = 0;
 	m_handThread->SetFingerDrive(speed);
 
+	m_keepAliveTimer.stop();
 	m_running = false;
-	m_runStatusLbl->setText("Stopped");
+	updateControls();
+
+	// still initialising or failed, which is what the operator needs to see
+	if (m_hardwareReady)
+		m_runStatusLbl->setText("Stopped");
 }
 
 void MotorTest::onSpeed()
@@ -130,16 +602,14 @@ void MotorTest::onSpeed()
 
 void MotorTest::onDirectionChange()
 {
-	m_applyDirectionBtn->setEnabled(true);
-	m_actionStart->setEnabled(false);
-	m_actionSpeed->setEnabled(false);
+	m_directionPending = true;
+	updateControls();
 }
 
 void MotorTest::onApplyDirection()
 {
-	m_applyDirectionBtn->setEnabled(false);
-	m_actionStart->setEnabled(true);
-	m_actionSpeed->setEnabled(true);
+	m_directionPending = false;
+	updateControls();
 }
 
 void MotorTest::initControls()
@@ -147,7 +617,9 @@ void MotorTest::initControls()
     connect(m_directionBtn[DIR_OPEN], SIGNAL(clicked()), SLOT(onDirectionChange()));
     connect(m_directionBtn[DIR_CLOSE], SIGNAL(clicked()), SLOT(onDirectionChange()));
 	connect(m_applyDirectionBtn, SIGNAL(clicked()), SLOT(onApplyDirection()));
-	m_applyDirectionBtn->setEnabled(false);
+	connect(m_plotBtn, SIGNAL(toggled(bool)), SLOT(onPlot(bool)));
+	connect(m_calibrateBtn, SIGNAL(clicked()), SLOT(onCalibrate()));
+	connect(m_sequenceBtn, SIGNAL(clicked()), SLOT(onSequence()));
 }
 
 void MotorTest::layoutWindow()
@@ -194,8 +666,20 @@ void MotorTest::layoutWindow()
 		hLayout->addWidget(m_positionLbl[i]);
 	}
 	hLayout->addSpacerItem(new QSpacerItem(10, 10, QSizePolicy::Expanding, QSizePolicy::Fixed));
+
+	m_plotBtn = new QPushButton("Plot");
+	m_plotBtn->setCheckable(true);
+	m_plotBtn->setChecked(true);
+	hLayout->addWidget(m_plotBtn);
+	m_calibrateBtn = new QPushButton("Cal");
+	hLayout->addWidget(m_calibrateBtn);
+	m_sequenceBtn = new QPushButton("Seq");
+	hLayout->addWidget(m_sequenceBtn);
 	vLayout->addLayout(hLayout);
 
+	m_plot = new PositionPlot;
+	vLayout->addWidget(m_plot);
+
 	vLayout->addSpacerItem(new QSpacerItem(10, 10, QSizePolicy::Fixed, QSizePolicy::Expanding));
 	
 	centralWidget()->setLayout(vLayout);
@@ -12,10 +12,13 @@
 #include <qlabel.h>
 #include <qpushbutton.h>
 #include <qstatusbar.h>
-#include <qmutex.h>
+#include <qtimer.h>
+#include <qelapsedtimer.h>
+#include <qsocketnotifier.h>
 
 #include "ui_motortest.h"
 #include "handcontrolthread.h"
+#include "positionplot.h"
 
 class MotorTest : public QMainWindow
 {
@@ -31,27 +34,73 @@ public slots:
 	void onSpeed();
 	void onDirectionChange();
 	void onApplyDirection();
-
-	void batteryLevelUpdated();
-	void fingerPositionUpdated();
+	void onPlot(bool show);
+	void onCalibrate();
+	void onCalibrationFinished(bool ok);
+	void onSequence();
+	void onSequenceFinished(bool ok);
+	void onHardwareReady(bool ok);
+	void onHandThreadFinished();
+	void onFingerStalled(int finger);
+	void onFingerEndStop(int finger);
+	void onHeartbeatLost();
+	void onStateReady();
+	void onKeepAlive();
+	void onFirstFrame();
 
 protected:
 	void closeEvent(QCloseEvent *);
-	void timerEvent(QTimerEvent *);
+	void showEvent(QShowEvent *event);
 
 private:
 	void layoutWindow();
 	void initControls();
+	void configureHandThread();
+	void logLoopStats(const char *label);
+	void fingerStopped(int finger, const char *reason);
+	void showState(const HandState &state);
+	void updateControls();
 
 	Ui::MotorTestClass ui;
 
-	int m_timer;
 	int m_runSpeed;
 	bool m_running;
-	QMutex m_newBatteryDataMutex;
-	bool m_newBatteryData;
-	QMutex m_newFingerPosDataMutex;
-	bool m_newFingerPosData;
+	bool m_calibrating;
+	// a direction picked but not yet applied
+	bool m_directionPending;
+	bool m_fingerRunning[2];
+
+	// last values written to the labels, labels are only touched on a change
+	int m_shownPosition[2];
+	int m_shownBattery;
+	int m_shownGain;
+	quint32 m_labelUpdates;
+
+	// sequence file from -seq, and the step last shown for the running one;
+	// steps only show while a sequence is active, as a snapshot taken after
+	// sequenceFinished may still have been published with one running
+	QString m_sequenceFile;
+	bool m_sequenceActive;
+	int m_sequenceSteps;
+	int m_shownSequenceStep;
+
+	// seq of the last sample handed to the plot
+	quint32 m_plotSeq;
+
+	// startup times, from the window being made
+	QElapsedTimer m_startupTimer;
+	bool m_hardwareReady;
+	bool m_firstFrameShown;
+	bool m_firstStateShown;
+
+	// wakes the GUI when the control thread has a new state, or polls for it
+	// where the control thread has no pipe to wake us with
+	QSocketNotifier *m_stateNotifier;
+	QTimer m_pollTimer;
+
+	// tells the heartbeat deadman we are alive, only while driving
+	QTimer m_keepAliveTimer;
+	int m_keepAliveMs;
 	
 	HandControlThread *m_handThread;
 
@@ -64,6 +113,10 @@ private:
 	QPushButton *m_applyDirectionBtn;
 	QLineEdit *m_speedEdit;
 	QLabel *m_positionLbl[2];
+	QPushButton *m_plotBtn;
+	QPushButton *m_calibrateBtn;
+	QPushButton *m_sequenceBtn;
+	PositionPlot *m_plot;
 	QStatusBar *m_statusBar;
 	QLabel *m_runStatusLbl;
 	QLabel *m_batteryLevelLbl;
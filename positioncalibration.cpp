@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <QFile>
+#include <QDataStream>
+#include <QVector>
+
+#include "positioncalibration.h"
+
+static const quint32 CAL_FILE_MAGIC = 0x4d54434c;	// "MTCL"
+static const quint32 CAL_FILE_VERSION = 1;
+
+PositionCalibration::PositionCalibration()
+{
+	setIdentity();
+}
+
+void PositionCalibration::setIdentity()
+{
+	for (int i = 0; i < NUM_FINGERS; i++) {
+		for (int raw = 0; raw < CAL_TABLE_SIZE; raw++)
+			m_table[i][raw] = raw;
+
+		m_calibrated[i] = false;
+	}
+}
+
+bool PositionCalibration::isCalibrated() const
+{
+	for (int i = 0; i < NUM_FINGERS; i++) {
+		if (!m_calibrated[i])
+			return false;
+	}
+
+	return true;
+}
+
+bool PositionCalibration::build(int finger, quint16 *raw, int count)
+{
+	if (finger < 0 || finger >= NUM_FINGERS || count < 2)
+		return false;
+
+	bool rising = raw[count - 1] > raw[0];
+
+	// the sensor has to move one way over the sweep, flatten any noise that
+	// goes back on itself so the table is monotonic
+	int last = raw[0] < CAL_TABLE_SIZE ? raw[0] : CAL_TABLE_SIZE - 1;
+
+	for (int k = 0; k < count; k++) {
+		int r = raw[k] < CAL_TABLE_SIZE ? raw[k] : CAL_TABLE_SIZE - 1;
+
+		if ((rising && r < last) || (!rising && r > last))
+			r = last;
+
+		raw[k] = r;
+		last = r;
+	}
+
+	int first = raw[0];
+	int end = raw[count - 1];
+
+	if (first == end) {
+		qDebug("PositionCalibration: finger %d sensor did not change over the sweep", finger);
+		return false;
+	}
+
+	// sample k was taken at position 100 * k / (count - 1), interpolate between
+	// neighbouring samples and clamp beyond the ends; the table is filled in
+	// the direction of the sweep, so the search for k carries on from the
+	// last raw value rather than starting again
+	int step = rising ? 1 : -1;
+	int k = 1;
+
+	for (int n = 0, r = rising ? 0 : CAL_TABLE_SIZE - 1; n < CAL_TABLE_SIZE; n++, r += step) {
+		int pos;
+
+		if ((rising && r <= first) || (!rising && r >= first)) {
+			pos = 0;
+		}
+		else if ((rising && r >= end) || (!rising && r <= end)) {
+			pos = 100;
+		}
+		else {
+			while ((rising && raw[k] < r) || (!rising && raw[k] > r))
+				k++;
+
+			// raw[k - 1] is before r and raw[k] at or past it
+			int span = raw[k] - raw[k - 1];
+			int frac = (span != 0) ? ((r - raw[k - 1]) * 1000) / span : 1000;
+
+			pos = ((k - 1) * 1000 + frac) * 100 / ((count - 1) * 1000);
+		}
+
+		m_table[finger][r] = pos;
+	}
+
+	m_calibrated[finger] = true;
+
+	return true;
+}
+
+bool PositionCalibration::load(const QString &path)
+{
+	QFile file(path);
+
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream in(&file);
+	quint32 magic, version, fingers, size;
+
+	in >> magic >> version >> fingers >> size;
+
+	if (magic != CAL_FILE_MAGIC || version != CAL_FILE_VERSION
+			|| fingers != (quint32) NUM_FINGERS || size != (quint32) CAL_TABLE_SIZE) {
+		qDebug("PositionCalibration: %s is not a calibration file for this build",
+			path.toLocal8Bit().constData());
+		return false;
+	}
+
+	// read into a copy so a short file leaves the current tables alone
+	QVector<quint16> table(NUM_FINGERS * CAL_TABLE_SIZE);
+
+	for (int n = 0; n < table.size(); n++)
+		in >> table[n];
+
+	if (in.status() != QDataStream::Ok) {
+		qDebug("PositionCalibration: %s is truncated", path.toLocal8Bit().constData());
+		return false;
+	}
+
+	for (int i = 0; i < NUM_FINGERS; i++) {
+		for (int raw = 0; raw < CAL_TABLE_SIZE; raw++)
+			m_table[i][raw] = table[i * CAL_TABLE_SIZE + raw];
+
+		m_calibrated[i] = true;
+	}
+
+	return true;
+}
+
+bool PositionCalibration::save(const QString &path)
+{
+	QFile file(path);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qDebug("PositionCalibration: could not write %s", path.toLocal8Bit().constData());
+		return false;
+	}
+
+	QDataStream out(&file);
+
+	out << CAL_FILE_MAGIC << CAL_FILE_VERSION << (quint32) NUM_FINGERS << (quint32) CAL_TABLE_SIZE;
+
+	for (int i = 0; i < NUM_FINGERS; i++) {
+		for (int raw = 0; raw < CAL_TABLE_SIZE; raw++)
+			out << m_table[i][raw];
+	}
+
+	return out.status() == QDataStream::Ok;
+}
+
+quint32 PositionCalibration::checksum() const
+{
+	quint32 hash = 2166136261u;
+
+	for (int i = 0; i < NUM_FINGERS; i++) {
+		for (int raw = 0; raw < CAL_TABLE_SIZE; raw++) {
+			hash = (hash ^ (m_table[i][raw] & 0xff)) * 16777619u;
+			hash = (hash ^ (m_table[i][raw] >> 8)) * 16777619u;
+		}
+	}
+
+	return hash;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef POSITIONCALIBRATION_H
+#define POSITIONCALIBRATION_H
+
+#include <QString>
+
+#include "handcontrolthread.h"
+
+/// raw ADC samples at or above this are treated as the top of the table
+const int CAL_TABLE_SIZE = 4096;
+
+/// Per-finger lookup table from raw position ADC samples to calibrated 0 - 100
+/// positions, so the control loop maps a sample with one indexed load.
+/// The tables are built from a constant speed sweep of each finger, where
+/// position is taken as proportional to time, and saved to disk in full so
+/// loading needs no arithmetic at all.
+class PositionCalibration
+{
+public:
+	PositionCalibration();
+
+	/// raw samples pass straight through (the uncalibrated behaviour)
+	void setIdentity();
+
+	/// true once every finger has a table, from a file or a sweep, so the
+	/// positions are 0 - 100 rather than raw samples
+	bool isCalibrated() const;
+
+	quint16 position(int finger, quint16 raw) const
+	{
+		return m_table[finger][raw < CAL_TABLE_SIZE ? raw : CAL_TABLE_SIZE - 1];
+	}
+
+	/// builds finger's table from count raw samples taken at equal intervals
+	/// while the finger was driven from 0 to 100 at a constant speed
+	/// the samples are flattened in place, so this needs no memory of its own
+	bool build(int finger, quint16 *raw, int count);
+
+	bool load(const QString &path);
+	bool save(const QString &path);
+
+	/// FNV-1a hash of the tables, so a trace can say which calibration it ran with
+	quint32 checksum() const;
+
+private:
+	quint16 m_table[NUM_FINGERS][CAL_TABLE_SIZE];
+	bool m_calibrated[NUM_FINGERS];
+};
+
+#endif // POSITIONCALIBRATION_H
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <qpainter.h>
+#include <qevent.h>
+
+#include "positionplot.h"
+
+static const Qt::GlobalColor traceColors[PLOT_NUM_TRACES] = {
+	Qt::green, Qt::yellow, Qt::darkGreen, Qt::darkYellow
+};
+
+PositionPlot::PositionPlot(QWidget *parent)
+	: QWidget(parent)
+{
+	// paintEvent fills every pixel it is asked for
+	setAttribute(Qt::WA_OpaquePaintEvent);
+
+	m_windowSeconds = 10;
+	m_usPerColumn = (m_windowSeconds * 1000000LL) / PLOT_MAX_COLUMNS;
+	m_positionMax = 100;
+
+	clear();
+}
+
+QSize PositionPlot::sizeHint() const
+{
+	return QSize(PLOT_MAX_COLUMNS, 80);
+}
+
+void PositionPlot::setWindowSeconds(int seconds)
+{
+	if (seconds < 1)
+		seconds = 1;
+
+	m_windowSeconds = seconds;
+	m_usPerColumn = (m_windowSeconds * 1000000LL) / qMax(width(), 1);
+
+	clear();
+}
+
+// raw samples until the hand is calibrated, the columns keep the values so
+// they are only drawn again
+void PositionPlot::setPositionRange(int max)
+{
+	if (max < 1 || max == m_positionMax)
+		return;
+
+	m_positionMax = max;
+
+	update();
+}
+
+void PositionPlot::clear()
+{
+	m_newest = 0;
+	m_count = 0;
+	m_newestBucket = -1;
+
+	for (int i = 0; i < PLOT_NUM_TRACES; i++)
+		m_last[i] = 0;
+
+	update();
+}
+
+void PositionPlot::pushColumn(const qint16 *values)
+{
+	m_newest = (m_newest + 1) % PLOT_MAX_COLUMNS;
+
+	if (m_count < PLOT_MAX_COLUMNS)
+		m_count++;
+
+	for (int i = 0; i < PLOT_NUM_TRACES; i++) {
+		m_columns[m_newest].min[i] = values[i];
+		m_columns[m_newest].max[i] = values[i];
+	}
+}
+
+void PositionPlot::addSamples(const FingerSample *samples, int count)
+{
+	int scrolled = 0;
+	qint16 values[PLOT_NUM_TRACES];
+
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < NUM_FINGERS; j++) {
+			values[j] = samples[i].position[j];
+			values[NUM_FINGERS + j] = samples[i].drive[j];
+		}
+
+		qint64 bucket = samples[i].timestampUs / m_usPerColumn;
+
+		if (m_newestBucket < 0) {
+			pushColumn(values);
+			m_newestBucket = bucket;
+			scrolled++;
+		}
+		else if (bucket > m_newestBucket) {
+			qint64 gap = bucket - m_newestBucket;
+
+			if (gap > PLOT_MAX_COLUMNS)
+				gap = PLOT_MAX_COLUMNS;
+
+			// nothing was sampled in the skipped columns (idle), hold the last values
+			for (qint64 k = 1; k < gap; k++)
+				pushColumn(m_last);
+
+			pushColumn(values);
+			m_newestBucket = bucket;
+			scrolled += gap;
+		}
+		else {
+			Column &col = m_columns[m_newest];
+
+			for (int j = 0; j < PLOT_NUM_TRACES; j++) {
+				if (values[j] < col.min[j])
+					col.min[j] = values[j];
+				else if (values[j] > col.max[j])
+					col.max[j] = values[j];
+			}
+		}
+
+		for (int j = 0; j < PLOT_NUM_TRACES; j++)
+			m_last[j] = values[j];
+	}
+
+	if (count == 0 || !isVisible())
+		return;
+
+	int w = width();
+
+	if (scrolled >= w - 1) {
+		update();
+	}
+	else if (scrolled > 0) {
+		// move the old pixels, then repaint the columns that scrolled in plus the
+		// one that was still filling at the last paint
+		scroll(-scrolled, 0);
+		update(w - scrolled - 1, 0, scrolled + 1, height());
+	}
+	else {
+		update(w - 1, 0, 1, height());
+	}
+}
+
+int PositionPlot::traceY(int trace, int value) const
+{
+	int h = height() - 1;
+
+	// positions are 0 - m_positionMax, drives -100 - 100
+	if (trace < NUM_FINGERS)
+		return h - (qMin(value, m_positionMax) * h) / m_positionMax;
+
+	return h - ((value + 100) * h) / 200;
+}
+
+void PositionPlot::paintEvent(QPaintEvent *event)
+{
+	QPainter painter(this);
+	const QRect &r = event->rect();
+	int w = width();
+	int mid = traceY(NUM_FINGERS, 0);
+
+	painter.fillRect(r, Qt::black);
+	painter.setPen(Qt::darkGray);
+	painter.drawLine(r.left(), mid, r.right(), mid);
+
+	for (int x = r.left(); x <= r.right(); x++) {
+		int age = w - 1 - x;
+
+		if (age < 0 || age >= m_count)
+			continue;
+
+		const Column &col = m_columns[(m_newest - age + PLOT_MAX_COLUMNS) % PLOT_MAX_COLUMNS];
+
+		// drives first so the positions are drawn on top
+		for (int i = PLOT_NUM_TRACES - 1; i >= 0; i--) {
+			painter.setPen(traceColors[i]);
+			painter.drawLine(x, traceY(i, col.max[i]), x, traceY(i, col.min[i]));
+		}
+	}
+}
+
+void PositionPlot::resizeEvent(QResizeEvent *)
+{
+	m_usPerColumn = (m_windowSeconds * 1000000LL) / qMax(width(), 1);
+
+	clear();
+}
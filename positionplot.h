@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef POSITIONPLOT_H
+#define POSITIONPLOT_H
+
+#include <qwidget.h>
+
+#include "handcontrolthread.h"
+
+// a position and a drive trace for each finger
+const int PLOT_NUM_TRACES = 2 * NUM_FINGERS;
+
+// widest plot we keep columns for, the display is 320 wide
+const int PLOT_MAX_COLUMNS = 320;
+
+// Strip chart of finger position and drive over a sliding time window.
+// Samples are decimated to one min/max bucket per pixel column, and as time
+// advances the existing pixels are scrolled left so only the new columns on
+// the right are repainted.
+class PositionPlot : public QWidget
+{
+	Q_OBJECT
+
+public:
+	PositionPlot(QWidget *parent = 0);
+
+	void setWindowSeconds(int seconds);
+
+	/// top of the position scale, drives are always -100 - 100
+	void setPositionRange(int max);
+	void addSamples(const FingerSample *samples, int count);
+	void clear();
+
+	QSize sizeHint() const;
+
+protected:
+	void paintEvent(QPaintEvent *);
+	void resizeEvent(QResizeEvent *);
+
+private:
+	struct Column
+	{
+		qint16 min[PLOT_NUM_TRACES];
+		qint16 max[PLOT_NUM_TRACES];
+	};
+
+	void pushColumn(const qint16 *values);
+	int traceY(int trace, int value) const;
+
+	Column m_columns[PLOT_MAX_COLUMNS];
+	int m_newest;
+	int m_count;
+
+	// time bucket of the newest column, -1 when empty
+	qint64 m_newestBucket;
+	qint64 m_usPerColumn;
+	int m_windowSeconds;
+	int m_positionMax;
+
+	qint16 m_last[PLOT_NUM_TRACES];
+};
+
+#endif // POSITIONPLOT_H
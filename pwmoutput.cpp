@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <QtGlobal>
+
+#include "pwmoutput.h"
+
+// Q_OS_UNIX and Q_WS_QWS are only known once a Qt header is in
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+PwmOutput::PwmOutput()
+{
+	m_hasEnable = false;
+	m_duty = -1;
+	m_enabled = -1;
+}
+
+PwmOutput::~PwmOutput()
+{
+}
+
+PwmOutput *PwmOutput::create(const QByteArray &device, int frequencyHz)
+{
+	if (!device.startsWith("/sys/"))
+		return new DevPwmOutput(device);
+
+	// <chip>/pwm<channel>, a trailing / is allowed
+	QByteArray path = device;
+
+	while (path.endsWith('/'))
+		path.chop(1);
+
+	int slash = path.lastIndexOf('/');
+	QByteArray name = path.mid(slash + 1);
+	bool valid = name.startsWith("pwm") && name.size() > 3;
+
+	for (int i = 3; valid && i < name.size(); i++)
+		valid = (name.at(i) >= '0' && name.at(i) <= '9');
+
+	// anything else would quietly drive channel 0 of the wrong directory,
+	// an output with no channel fails to open instead
+	if (!valid) {
+		qDebug("PwmOutput: %s is not a sysfs PWM channel (.../pwmchip<n>/pwm<m>)", device.constData());
+		return new SysfsPwmOutput(path.left(slash), -1, frequencyHz);
+	}
+
+	return new SysfsPwmOutput(path.left(slash), name.mid(3).toInt(), frequencyHz);
+}
+
+bool PwmOutput::open()
+{
+	m_duty = -1;
+	m_enabled = -1;
+
+	return true;
+}
+
+void PwmOutput::close()
+{
+}
+
+int PwmOutput::setDuty(int percent)
+{
+	int writes = 0;
+
+	if (percent < 0)
+		percent = 0;
+	else if (percent > 100)
+		percent = 100;
+
+	// the duty cycle is left as it is while the channel is off
+	if (m_hasEnable && percent == 0) {
+		if (m_enabled != 0) {
+			writes++;
+			m_enabled = writeEnable(false) ? 0 : -1;
+		}
+
+		return writes;
+	}
+
+	// after a failed write the shadow is unknown, so the next call tries again
+	if (m_duty != percent) {
+		writes++;
+		m_duty = writeDuty(percent) ? percent : -1;
+	}
+
+	if (m_hasEnable && m_enabled != 1) {
+		writes++;
+		m_enabled = writeEnable(true) ? 1 : -1;
+	}
+
+	return writes;
+}
+
+bool PwmOutput::writeDuty(int)
+{
+	return true;
+}
+
+bool PwmOutput::writeEnable(bool)
+{
+	return true;
+}
+
+DevPwmOutput::DevPwmOutput(const QByteArray &device)
+{
+	m_device = device;
+	m_fd = -1;
+
+	for (int i = 0; i <= 100; i++)
+		m_dutyLength[i] = sprintf(m_dutyText[i], "%d", i);
+}
+
+DevPwmOutput::~DevPwmOutput()
+{
+	close();
+}
+
+bool DevPwmOutput::open()
+{
+	PwmOutput::open();
+
+#ifdef Q_WS_QWS
+	m_fd = ::open(m_device.constData(), O_RDWR);
+
+	if (m_fd < 0) {
+		qDebug("PwmOutput: could not open %s", m_device.constData());
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void DevPwmOutput::close()
+{
+#ifdef Q_WS_QWS
+	if (m_fd >= 0)
+		::close(m_fd);
+#endif
+
+	m_fd = -1;
+}
+
+bool DevPwmOutput::writeDuty(int percent)
+{
+#ifdef Q_WS_QWS
+	if (m_fd < 0)
+		return false;
+
+	if (write(m_fd, m_dutyText[percent], m_dutyLength[percent]) < 0) {
+		qDebug("PwmOutput: error writing %s, errno = %d", m_device.constData(), errno);
+		return false;
+	}
+
+	return true;
+#else
+	Q_UNUSED(percent);
+	return false;
+#endif
+}
+
+SysfsPwmOutput::SysfsPwmOutput(const QByteArray &chip, int channel, int frequencyHz)
+{
+	if (frequencyHz < PWM_MIN_FREQUENCY_HZ || frequencyHz > PWM_MAX_FREQUENCY_HZ) {
+		qDebug("PwmOutput: %d Hz is outside %d - %d Hz, using %d Hz", frequencyHz,
+			PWM_MIN_FREQUENCY_HZ, PWM_MAX_FREQUENCY_HZ, PWM_MIN_FREQUENCY_HZ);
+		frequencyHz = PWM_MIN_FREQUENCY_HZ;
+	}
+
+	char dir[16];
+	sprintf(dir, "/pwm%d", channel);
+
+	m_hasEnable = true;
+	m_chip = chip;
+	m_channel = channel;
+	m_channelDir = chip + dir;
+	m_periodNs = 1000000000 / frequencyHz;
+	m_dutyFd = -1;
+	m_enableFd = -1;
+
+	for (int i = 0; i <= 100; i++)
+		m_dutyLength[i] = sprintf(m_dutyText[i], "%d", (int) (((qint64) m_periodNs * i) / 100));
+}
+
+SysfsPwmOutput::~SysfsPwmOutput()
+{
+	close();
+}
+
+/// one-off write of a channel attribute, outside the hot path
+bool SysfsPwmOutput::writeAttribute(const char *name, const char *text)
+{
+#ifdef Q_WS_QWS
+	QByteArray path = m_channelDir + "/" + name;
+	int fd = ::open(path.constData(), O_WRONLY);
+
+	if (fd < 0) {
+		qDebug("PwmOutput: could not open %s", path.constData());
+		return false;
+	}
+
+	bool ok = (write(fd, text, strlen(text)) >= 0);
+
+	if (!ok)
+		qDebug("PwmOutput: error writing %s, errno = %d", path.constData(), errno);
+
+	::close(fd);
+
+	return ok;
+#else
+	Q_UNUSED(name);
+	Q_UNUSED(text);
+	return false;
+#endif
+}
+
+bool SysfsPwmOutput::open()
+{
+	PwmOutput::open();
+
+	if (m_channel < 0)
+		return false;
+
+#ifdef Q_WS_QWS
+	char text[16];
+
+	// the channel directory only appears once it is exported
+	if (access(m_channelDir.constData(), F_OK) != 0) {
+		QByteArray path = m_chip + "/export";
+		int fd = ::open(path.constData(), O_WRONLY);
+
+		if (fd < 0) {
+			qDebug("PwmOutput: could not open %s", path.constData());
+			return false;
+		}
+
+		sprintf(text, "%d", m_channel);
+
+		if (write(fd, text, strlen(text)) < 0)
+			qDebug("PwmOutput: error exporting %s, errno = %d", m_channelDir.constData(), errno);
+
+		::close(fd);
+	}
+
+	// off with no duty first, the driver refuses a period shorter than the
+	// duty cycle left from before
+	writeAttribute("enable", "0");
+	writeAttribute("duty_cycle", "0");
+
+	sprintf(text, "%d", m_periodNs);
+
+	if (!writeAttribute("period", text))
+		return false;
+
+	m_dutyFd = ::open((m_channelDir + "/duty_cycle").constData(), O_WRONLY);
+	m_enableFd = ::open((m_channelDir + "/enable").constData(), O_WRONLY);
+
+	if (m_dutyFd < 0 || m_enableFd < 0) {
+		qDebug("PwmOutput: could not open %s", m_channelDir.constData());
+		close();
+		return false;
+	}
+
+	m_duty = 0;
+	m_enabled = 0;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void SysfsPwmOutput::close()
+{
+#ifdef Q_WS_QWS
+	if (m_dutyFd >= 0)
+		::close(m_dutyFd);
+
+	if (m_enableFd >= 0)
+		::close(m_enableFd);
+#endif
+
+	m_dutyFd = -1;
+	m_enableFd = -1;
+}
+
+bool SysfsPwmOutput::writeDuty(int percent)
+{
+#ifdef Q_WS_QWS
+	if (m_dutyFd < 0)
+		return false;
+
+	// sysfs takes each write whole from the start of the attribute
+	if (pwrite(m_dutyFd, m_dutyText[percent], m_dutyLength[percent], 0) < 0) {
+		qDebug("PwmOutput: error writing %s duty_cycle, errno = %d", m_channelDir.constData(), errno);
+		return false;
+	}
+
+	return true;
+#else
+	Q_UNUSED(percent);
+	return false;
+#endif
+}
+
+bool SysfsPwmOutput::writeEnable(bool enable)
+{
+#ifdef Q_WS_QWS
+	if (m_enableFd < 0)
+		return false;
+
+	if (pwrite(m_enableFd, enable ? "1" : "0", 1, 0) < 0) {
+		qDebug("PwmOutput: error writing %s enable, errno = %d", m_channelDir.constData(), errno);
+		return false;
+	}
+
+	return true;
+#else
+	Q_UNUSED(enable);
+	return false;
+#endif
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef PWMOUTPUT_H
+#define PWMOUTPUT_H
+
+#include <QByteArray>
+
+/// range of PWM frequencies the motor drivers take (Hz)
+const int PWM_MIN_FREQUENCY_HZ = 5000;
+const int PWM_MAX_FREQUENCY_HZ = 10000;
+
+/// One PWM channel driving a finger motor.
+/// Keeps a shadow of what the hardware was last given and only writes what
+/// changes, so repeated zeroes while stopping (or a drive level that is set
+/// again unchanged) cost nothing. This base class is the simulated channel,
+/// which counts the writes it would make without touching anything.
+class PwmOutput
+{
+public:
+	PwmOutput();
+	virtual ~PwmOutput();
+
+	/// picks the right output for device: a sysfs channel directory
+	/// (/sys/class/pwm/pwmchip<n>/pwm<m>) or an older /dev/pwm<n> device;
+	/// a /sys path that does not end in pwm<m> gives an output that will not open
+	static PwmOutput *create(const QByteArray &device, int frequencyHz);
+
+	virtual bool open();
+	virtual void close();
+
+	/// sets the duty cycle, 0 - 100 percent, returns the writes it took
+	int setDuty(int percent);
+
+protected:
+	/// make the hardware match, only called for a change; false on an error
+	virtual bool writeDuty(int percent);
+	virtual bool writeEnable(bool enable);
+
+	/// the channel is turned off with writeEnable rather than a zero duty
+	bool m_hasEnable;
+
+	/// what the hardware was last given, -1 when not known
+	int m_duty;
+	int m_enabled;
+};
+
+/// Channel of the older /dev/pwm<n> driver, which takes the duty cycle in
+/// percent as text
+class DevPwmOutput : public PwmOutput
+{
+public:
+	DevPwmOutput(const QByteArray &device);
+	~DevPwmOutput();
+
+	bool open();
+	void close();
+
+protected:
+	bool writeDuty(int percent);
+
+private:
+	QByteArray m_device;
+	int m_fd;
+
+	/// every duty cycle as text, made once so a write does no formatting
+	char m_dutyText[101][4];
+	int m_dutyLength[101];
+};
+
+/// Channel of the mainline /sys/class/pwm interface, where the period and
+/// duty cycle are in nsec and the channel is switched with enable
+class SysfsPwmOutput : public PwmOutput
+{
+public:
+	/// channel -1 for one that never opens
+	SysfsPwmOutput(const QByteArray &chip, int channel, int frequencyHz);
+	~SysfsPwmOutput();
+
+	bool open();
+	void close();
+
+protected:
+	bool writeDuty(int percent);
+	bool writeEnable(bool enable);
+
+private:
+	bool writeAttribute(const char *name, const char *text);
+
+	QByteArray m_chip;
+	QByteArray m_channelDir;
+	int m_channel;
+	int m_periodNs;
+
+	/// kept open for the hot path
+	int m_dutyFd;
+	int m_enableFd;
+
+	/// every duty cycle as nsec text, made once so a write does no formatting
+	char m_dutyText[101][12];
+	int m_dutyLength[101];
+};
+
+#endif // PWMOUTPUT_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <stdio.h>
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "rigbench.h"
+#include "handrig.h"
+
+/// drive level the hands are cycled at, as the GUI's default speed
+const qint16 BENCH_DRIVE_LEVEL = 70;
+
+int RigBench::run(const QStringList &args)
+{
+	int i = args.indexOf("-rigbench");
+
+	if (i < 0 || i + 2 >= args.size()) {
+		printf("usage: MotorTest -rigbench <hands|file> <sec>\n");
+		return 1;
+	}
+
+	HandRig rig;
+	bool isCount;
+	int count = args.at(i + 1).toInt(&isCount);
+	int seconds = args.at(i + 2).toInt();
+
+	// as -rig, a number of simulated hands or a file of hands
+	if (!isCount) {
+		rig.AddHands(args.at(i + 1));
+	}
+	else {
+		for (int n = 0; n < count && n < RIG_MAX_HANDS; n++)
+			rig.AddHand()->SetSimulated(true);
+	}
+
+	if (seconds <= 0 || !rig.startRig()) {
+		printf("rigbench: nothing to run\n");
+		return 1;
+	}
+
+	// the rig thread does the work, this one only paces the drive commands
+	QMutex mutex;
+	QWaitCondition pause;
+	qint16 drive[NUM_FINGERS];
+	qint16 level = BENCH_DRIVE_LEVEL;
+
+	mutex.lock();
+
+	for (int s = 0; s < seconds; s++) {
+		for (int f = 0; f < NUM_FINGERS; f++)
+			drive[f] = level;
+
+		for (int n = 0; n < rig.HandCount(); n++)
+			rig.Hand(n)->SetFingerDrive(drive);
+
+		level = -level;
+		pause.wait(&mutex, 1000);
+	}
+
+	mutex.unlock();
+
+	rig.stopRig();
+
+	quint64 totalLateUs = 0;
+	quint64 ticks = 0;
+	quint32 worstUs = 0;
+
+	for (int n = 0; n < rig.HandCount(); n++) {
+		LoopStats stats;
+		rig.Hand(n)->GetLoopStats(&stats);
+
+		printf("hand %2d: %u ticks, avg %u us, max %u us late\n", n + 1, stats.ticks,
+			stats.ticks ? (quint32) (stats.totalLateUs / stats.ticks) : 0, stats.maxLateUs);
+
+		totalLateUs += stats.totalLateUs;
+		ticks += stats.ticks;
+
+		if (stats.maxLateUs > worstUs)
+			worstUs = stats.maxLateUs;
+	}
+
+	printf("rig of %d hands over %d s: avg %u us, worst %u us late\n", rig.HandCount(), seconds,
+		ticks ? (quint32) (totalLateUs / ticks) : 0, worstUs);
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef RIGBENCH_H
+#define RIGBENCH_H
+
+#include <QStringList>
+
+/// Console benchmark of a test rig, no window. Runs a HandRig of simulated (or
+/// listed) hands on the wall clock, drives every hand open then closed each
+/// second, and prints each hand's loop jitter so rigs of different sizes can be
+/// compared:
+///   MotorTest -rigbench 1 30
+///   MotorTest -rigbench 16 30
+class RigBench
+{
+public:
+	/// runs the benchmark from -rigbench <n|file> <sec>, returns the exit code
+	static int run(const QStringList &args);
+};
+
+#endif // RIGBENCH_H
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <qboxlayout.h>
+#include <qgridlayout.h>
+#include <qapplication.h>
+#include <qstringlist.h>
+
+#include "rigwindow.h"
+#include "handclock.h"
+
+RigWindow::RigWindow(QWidget *parent)
+	: QWidget(parent)
+{
+	m_runSpeed = 70;
+	m_cycleLevel = 0;
+
+	m_rig = new HandRig(this);
+
+	configureRig();
+	layoutWindow(m_rig->HandCount());
+
+	setWindowTitle("MotorTest Rig");
+
+	connect(m_exitBtn, SIGNAL(clicked()), SLOT(close()));
+	connect(m_openBtn, SIGNAL(clicked()), SLOT(onOpenAll()));
+	connect(m_closeBtn, SIGNAL(clicked()), SLOT(onCloseAll()));
+	connect(m_stopBtn, SIGNAL(clicked()), SLOT(onStopAll()));
+	connect(&m_cycleTimer, SIGNAL(timeout()), SLOT(onCycle()));
+	connect(m_rig, SIGNAL(finished()), SLOT(onRigFinished()));
+
+	// each hand pokes its own pipe when it publishes a new state
+	bool poll = false;
+
+	for (int i = 0; i < m_rig->HandCount(); i++) {
+		int fd = m_rig->Hand(i)->StateNotifierFd();
+
+		if (fd >= 0) {
+			m_stateNotifier[i] = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+			connect(m_stateNotifier[i], SIGNAL(activated(int)), SLOT(onStateReady()));
+		}
+		else {
+			m_stateNotifier[i] = NULL;
+			poll = true;
+		}
+	}
+
+	if (poll) {
+		connect(&m_pollTimer, SIGNAL(timeout()), SLOT(onStateReady()));
+		m_pollTimer.start(33);
+	}
+
+	if (!m_rig->startRig())
+		qDebug("RigWindow: no hands to run");
+}
+
+RigWindow::~RigWindow()
+{
+}
+
+// Command line options for the rig
+//   -rig <n>         n simulated hands
+//   -rig <file>      a hand per line of file, see HandRig::AddHands
+//   -simclock        run on a virtual clock, as fast as possible
+//   -simtime <sec>   stop after this many seconds of clock time
+//   -rigcycle <sec>  drive every hand open, then closed, each <sec>, for an
+//                    unattended run; the jitter figures are logged on exit
+void RigWindow::configureRig()
+{
+	QStringList args = QApplication::arguments();
+
+	if (args.contains("-simclock"))
+		m_rig->SetClock(new VirtualClock);
+
+	int i = args.indexOf("-rig");
+
+	if (i >= 0 && i + 1 < args.size()) {
+		bool isCount;
+		int count = args.at(i + 1).toInt(&isCount);
+
+		if (!isCount) {
+			m_rig->AddHands(args.at(i + 1));
+		}
+		else {
+			for (int n = 0; n < count && n < RIG_MAX_HANDS; n++)
+				m_rig->AddHand()->SetSimulated(true);
+		}
+	}
+
+	i = args.indexOf("-simtime");
+
+	if (i >= 0 && i + 1 < args.size()) {
+		for (int n = 0; n < m_rig->HandCount(); n++)
+			m_rig->Hand(n)->SetRunTime(args.at(i + 1).toInt() * 1000LL);
+	}
+
+	i = args.indexOf("-rigcycle");
+
+	if (i >= 0 && i + 1 < args.size()) {
+		m_cycleLevel = m_runSpeed;
+		m_cycleTimer.start(args.at(i + 1).toInt() * 1000);
+	}
+}
+
+void RigWindow::closeEvent(QCloseEvent *)
+{
+	m_cycleTimer.stop();
+	m_pollTimer.stop();
+	m_rig->stopRig();
+
+	// worst hand against the single hand figures
+	quint32 worstUs = 0;
+	int worstHand = 0;
+
+	for (int i = 0; i < m_rig->HandCount(); i++) {
+		LoopStats stats;
+		m_rig->Hand(i)->GetLoopStats(&stats);
+
+		if (stats.ticks == 0)
+			continue;
+
+		qDebug("Hand %d jitter: %u ticks, avg %u us, max %u us late", i + 1,
+			stats.ticks, (quint32) (stats.totalLateUs / stats.ticks), stats.maxLateUs);
+
+		if (stats.maxLateUs > worstUs) {
+			worstUs = stats.maxLateUs;
+			worstHand = i;
+		}
+	}
+
+	qDebug("Rig of %d hands: worst jitter %u us late (hand %d)", m_rig->HandCount(),
+		worstUs, worstHand + 1);
+}
+
+void RigWindow::onRigFinished()
+{
+	// the rig only stops by itself at the end of a timed (-simtime) run
+	if (isVisible())
+		close();
+}
+
+void RigWindow::driveAll(qint16 level)
+{
+	qint16 drive[NUM_FINGERS];
+
+	for (int i = 0; i < NUM_FINGERS; i++)
+		drive[i] = level;
+
+	for (int i = 0; i < m_rig->HandCount(); i++)
+		m_rig->Hand(i)->SetFingerDrive(drive);
+}
+
+void RigWindow::onOpenAll()
+{
+	driveAll(m_runSpeed);
+}
+
+void RigWindow::onCloseAll()
+{
+	driveAll(-m_runSpeed);
+}
+
+void RigWindow::onStopAll()
+{
+	m_cycleTimer.stop();
+	driveAll(0);
+}
+
+void RigWindow::onCycle()
+{
+	m_cycleLevel = -m_cycleLevel;
+	driveAll(m_cycleLevel);
+}
+
+// a hand with nothing new is skipped by TakeState, so one wakeup covers all
+void RigWindow::onStateReady()
+{
+	HandState state;
+
+	for (int i = 0; i < m_rig->HandCount(); i++) {
+		if (m_rig->Hand(i)->TakeState(&state))
+			showHand(i, state);
+	}
+}
+
+void RigWindow::showHand(int hand, const HandState &state)
+{
+	LoopStats stats;
+	m_rig->Hand(hand)->GetLoopStats(&stats);
+
+	m_handLbl[hand]->setText(QString("%1: %2 %3  %4%  %5 us")
+		.arg(hand + 1, 2)
+		.arg(state.position[0], 4)
+		.arg(state.position[1], 4)
+		.arg(state.batteryLevel, 3)
+		.arg(stats.maxLateUs));
+}
+
+void RigWindow::layoutWindow(int numHands)
+{
+	setMaximumSize(320, 240);
+
+	QVBoxLayout *vLayout = new QVBoxLayout;
+
+	QHBoxLayout *hLayout = new QHBoxLayout;
+	m_exitBtn = new QPushButton("Exit");
+	hLayout->addWidget(m_exitBtn);
+	m_openBtn = new QPushButton("Open");
+	hLayout->addWidget(m_openBtn);
+	m_closeBtn = new QPushButton("Close");
+	hLayout->addWidget(m_closeBtn);
+	m_stopBtn = new QPushButton("Stop");
+	hLayout->addWidget(m_stopBtn);
+	vLayout->addLayout(hLayout);
+
+	// two columns of hands to fit 16 on the display
+	QGridLayout *grid = new QGridLayout;
+	grid->setSpacing(0);
+
+	QFont font = this->font();
+	font.setPointSize(7);
+
+	for (int i = 0; i < numHands; i++) {
+		m_handLbl[i] = new QLabel(QString("%1: -").arg(i + 1, 2));
+		m_handLbl[i]->setFont(font);
+		grid->addWidget(m_handLbl[i], i / 2, i % 2);
+	}
+
+	vLayout->addLayout(grid);
+	vLayout->addSpacerItem(new QSpacerItem(10, 10, QSizePolicy::Fixed, QSizePolicy::Expanding));
+
+	setLayout(vLayout);
+}
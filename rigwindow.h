@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef RIGWINDOW_H
+#define RIGWINDOW_H
+
+#include <qwidget.h>
+#include <qlabel.h>
+#include <qpushbutton.h>
+#include <qtimer.h>
+#include <qsocketnotifier.h>
+
+#include "handrig.h"
+
+// Compact view of a test rig, one line per hand, with open/close/stop for
+// every hand at once. Started with -rig on the command line.
+class RigWindow : public QWidget
+{
+	Q_OBJECT
+
+public:
+	RigWindow(QWidget *parent = 0);
+	~RigWindow();
+
+public slots:
+	void onOpenAll();
+	void onCloseAll();
+	void onStopAll();
+	void onCycle();
+	void onRigFinished();
+	void onStateReady();
+
+protected:
+	void closeEvent(QCloseEvent *);
+
+private:
+	void layoutWindow(int numHands);
+	void configureRig();
+	void driveAll(qint16 level);
+	void showHand(int hand, const HandState &state);
+
+	HandRig *m_rig;
+
+	int m_runSpeed;
+	qint16 m_cycleLevel;
+	QTimer m_cycleTimer;
+
+	// wake the window when a hand has a new state, or poll for them where
+	// the hands have no pipe to wake us with
+	QSocketNotifier *m_stateNotifier[RIG_MAX_HANDS];
+	QTimer m_pollTimer;
+
+	QPushButton *m_exitBtn;
+	QPushButton *m_openBtn;
+	QPushButton *m_closeBtn;
+	QPushButton *m_stopBtn;
+	QLabel *m_handLbl[RIG_MAX_HANDS];
+};
+
+#endif // RIGWINDOW_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <string.h>
+
+#include "samplehistory.h"
+
+SampleHistory::SampleHistory()
+	: m_head(0)
+{
+	// sequence 0 is never used so an unwritten slot never matches
+	m_nextSeq = 1;
+
+	for (int i = 0; i < SAMPLE_HISTORY_SIZE; i++)
+		memset(&m_slots[i].sample, 0, sizeof(FingerSample));
+}
+
+void SampleHistory::append(const FingerSample &iSample)
+{
+	quint32 seq = m_nextSeq++;
+
+	if (m_nextSeq == 0)
+		m_nextSeq = 1;
+
+	Slot &slot = m_slots[seq & (SAMPLE_HISTORY_SIZE - 1)];
+
+	// invalidate the slot while it is rewritten
+	slot.seq.fetchAndStoreOrdered(0);
+	slot.sample = iSample;
+	slot.sample.seq = seq;
+	slot.seq.fetchAndStoreOrdered((int) seq);
+
+	m_head.fetchAndStoreOrdered((int) seq);
+}
+
+quint32 SampleHistory::latestSeq()
+{
+	return (quint32) m_head.fetchAndAddOrdered(0);
+}
+
+int SampleHistory::fetchSince(quint32 iSinceSeq, FingerSample *oSamples, int iMax)
+{
+	quint32 head = latestSeq();
+
+	if (iSinceSeq >= head)
+		return 0;
+
+	// a reader that fell behind by more than the ring only gets what is left
+	quint32 first = iSinceSeq + 1;
+
+	if (head - first >= (quint32) SAMPLE_HISTORY_SIZE)
+		first = head - SAMPLE_HISTORY_SIZE + 1;
+
+	int count = 0;
+
+	for (quint32 seq = first; seq <= head && count < iMax; seq++) {
+		Slot &slot = m_slots[seq & (SAMPLE_HISTORY_SIZE - 1)];
+
+		// oldest samples are the ones the writer overwrites first, skip any
+		// that are being or have been rewritten
+		if ((quint32) slot.seq.fetchAndAddOrdered(0) != seq)
+			continue;
+
+		oSamples[count] = slot.sample;
+
+		if ((quint32) slot.seq.fetchAndAddOrdered(0) != seq)
+			continue;
+
+		count++;
+	}
+
+	return count;
+}
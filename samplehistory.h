@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#ifndef SAMPLEHISTORY_H
+#define SAMPLEHISTORY_H
+
+#include <QAtomicInt>
+
+#include "handcontrolthread.h"
+
+/// number of samples kept, around 15 seconds of finger positions at 33 Hz
+/// must be a power of 2
+const int SAMPLE_HISTORY_SIZE = 512;
+
+/// Fixed-size ring of FingerSamples with one writer (the control thread) and any
+/// number of independent readers.
+/// Each slot carries its own sequence number, cleared while the slot is being
+/// rewritten, so readers can detect and drop a sample that was overwritten under
+/// them without the writer ever taking a lock.
+class SampleHistory
+{
+public:
+	SampleHistory();
+
+	/// stamps iSample with the next sequence number and publishes it
+	/// only ever call from the one writer thread
+	void append(const FingerSample &iSample);
+
+	/// sequence number of the newest sample, 0 if there are none yet
+	quint32 latestSeq();
+
+	/// copies up to iMax samples newer than iSinceSeq, oldest first
+	/// returns the number of samples copied, the caller passes the seq of the
+	/// last one back in on the next call
+	int fetchSince(quint32 iSinceSeq, FingerSample *oSamples, int iMax);
+
+private:
+	struct Slot
+	{
+		QAtomicInt seq;
+		FingerSample sample;
+	};
+
+	Slot m_slots[SAMPLE_HISTORY_SIZE];
+
+	/// sequence number of the newest published sample
+	QAtomicInt m_head;
+
+	/// sequence number for the next append, writer only
+	quint32 m_nextSeq;
+};
+
+#endif // SAMPLEHISTORY_H
@@ -0,0 +1,39 @@
+TEMPLATE = app
+
+TARGET = alloccheck
+
+QT = core
+
+CONFIG += console
+CONFIG -= app_bundle
+
+# counts heap allocations in the control loop, see allocationcheck.h
+DEFINES += ALLOC_CHECK
+
+INCLUDEPATH += ../..
+
+HEADERS += ../../allocationcheck.h \
+           ../../handclock.h \
+           ../../handcontrolthread.h \
+           ../../handrig.h \
+           ../../handtrace.h \
+           ../../motionsequence.h \
+           ../../positioncalibration.h \
+           ../../pwmoutput.h \
+           ../../samplehistory.h
+
+SOURCES += main.cpp \
+           ../../allocationcheck.cpp \
+           ../../handclock.cpp \
+           ../../handcontrolthread.cpp \
+           ../../handrig.cpp \
+           ../../handtrace.cpp \
+           ../../motionsequence.cpp \
+           ../../positioncalibration.cpp \
+           ../../pwmoutput.cpp \
+           ../../samplehistory.cpp
+
+# replays the recorded trace, fails if the control loop allocated
+check.commands = ./$$TARGET $$PWD/steady.trace
+check.depends = $$TARGET
+QMAKE_EXTRA_TARGETS += check
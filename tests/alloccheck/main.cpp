@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2013 Neurolutions, Inc.
+ *
+ */
+
+#include <stdio.h>
+
+#include <QCoreApplication>
+#include <QStringList>
+
+#include "handcontrolthread.h"
+#include "handclock.h"
+#include "allocationcheck.h"
+
+// Replays a recorded trace through HandControlThread on a VirtualClock, flat
+// out, and fails if the control loop touched the heap after its warm-up or its
+// outputs did not match the trace. Run by "make check" on steady.trace, which
+// keeps to the steady state of driving, direction changes and idling: stalls,
+// calibration and sequences log through qDebug, which allocates.
+//   alloccheck <trace>
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QStringList args = app.arguments();
+
+	if (args.size() < 2) {
+		printf("usage: alloccheck <trace>\n");
+		return 2;
+	}
+
+	// nothing would be counted and every run would pass
+	if (!AllocationCheck::enabled()) {
+		printf("alloccheck: built without ALLOC_CHECK\n");
+		return 2;
+	}
+
+	HandControlThread hand;
+	hand.SetClock(new VirtualClock);
+
+	if (!hand.SetReplayFile(args.at(1)))
+		return 2;
+
+	hand.startThread();
+	hand.wait();
+	hand.stopThread();
+
+	LoopStats stats;
+	hand.GetLoopStats(&stats);
+
+	int allocations = hand.LoopAllocations();
+	int mismatches = hand.ReplayMismatches();
+
+	printf("alloccheck: %u active ticks, %d heap allocations, %d mismatched outputs\n",
+		stats.ticks, allocations, mismatches);
+
+	if (stats.ticks == 0 || allocations > 0 || mismatches > 0) {
+		printf("alloccheck: FAIL\n");
+		return 1;
+	}
+
+	printf("alloccheck: PASS\n");
+
+	return 0;
+}